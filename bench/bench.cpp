@@ -0,0 +1,150 @@
+// Front end throughput benchmark: generates synthetic programs and times tokenizing, parsing and codegen separately
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "resolve.hpp"
+#include "generation.hpp"
+#include "io.hpp"
+#include "clr_gen.hpp"
+
+// the kernel only tracks the peak RSS of the whole process, writing 5 to clear_refs resets it (linux 4.0+)
+// so it can be read per phase. without it the numbers are the running maximum instead
+static void reset_peak_rss() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// peak resident set size in KB since the last reset
+static long peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.starts_with("VmHWM:")) {
+            return std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct PhaseResult {
+    double ms = 0; // fastest run
+    size_t items = 0; // tokens, nodes or bytes of asm the phase produced
+    long peak_rss_kb = 0; // largest peak over the runs
+};
+
+// best of `repeat` runs, the minimum is the least noisy estimate of what the code costs
+template <typename Fn>
+static void time_phase(PhaseResult& result, int repeat, Fn&& fn) {
+    result.ms = 0;
+    for (int run = 0; run < repeat; run++) {
+        reset_peak_rss();
+        const auto start = std::chrono::steady_clock::now();
+        result.items = fn();
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        result.peak_rss_kb = std::max(result.peak_rss_kb, peak_rss_kb());
+        if (run == 0 || elapsed.count() < result.ms) {
+            result.ms = elapsed.count();
+        }
+    }
+}
+
+static void print_phase(std::string_view shape, size_t stmts, std::string_view phase, const PhaseResult& result,
+                        std::string_view unit) {
+    const double per_sec = result.ms > 0 ? static_cast<double>(result.items) / (result.ms / 1000.0) : 0;
+    std::cout << std::left << std::setw(8) << shape << std::right << std::setw(10) << stmts << "  "
+              << std::left << std::setw(10) << phase << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << result.ms << " ms" << std::setw(12) << result.items << ' '
+              << std::left << std::setw(7) << unit << std::right << std::setprecision(2)
+              << std::setw(10) << per_sec / 1e6 << " M" << unit << "/s"
+              << std::setw(10) << result.peak_rss_kb << " KB" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<Shape> shapes;
+    size_t stmts = 100000;
+    int repeat = 5;
+    OptLevel opt_level = OptLevel::O0;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "-O0") {
+            opt_level = OptLevel::O0;
+        } else if (arg == "-O1") {
+            opt_level = OptLevel::O1;
+        } else if (arg == "-O2") {
+            opt_level = OptLevel::O2;
+        } else if (arg == "--stmts" && i + 1 < argc) {
+            stmts = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--shape" && i + 1 < argc && parse_shape(argv[i + 1]).has_value()) {
+            shapes.push_back(parse_shape(argv[++i]).value());
+        } else {
+            std::cerr << "Incorrect call" << std::endl;
+            std::cerr << "Example: ./clear_bench [-O0|-O1|-O2] [--stmts 100000] [--repeat 5] [--shape lets|chain|deep|idents]..." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (shapes.empty()) {
+        shapes.assign(std::begin(all_shapes), std::end(all_shapes));
+    }
+
+    std::cout << "shape        stmts  phase           time          output        throughput   peak rss" << std::endl;
+    for (Shape shape : shapes) {
+        const std::string source = ClrGenerator(shape, stmts).generate();
+
+        // every phase runs on its own copy of the previous phase's output, so the timed region is the phase alone
+        std::vector<Token> tokens;
+        std::vector<std::string_view> symbols;
+        PhaseResult tokenize;
+        time_phase(tokenize, repeat, [&] {
+            Tokenizer tokenizer(source);
+            tokens = tokenizer.tokenize();
+            symbols = tokenizer.take_symbols();
+            return tokens.size();
+        });
+
+        std::optional<NodeProgram> prog;
+        PhaseResult parse;
+        time_phase(parse, repeat, [&] {
+            prog = Parser(tokens, symbols).parse_prog();
+            return prog.has_value() ? prog->node_count() : 0;
+        });
+        if (!prog.has_value()) {
+            std::cerr << "Unable to parse generated " << shape_name(shape) << " program" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        resolve_names(prog.value());
+
+        // nasm text is generated into /dev/null so the numbers do not include the disk
+        PhaseResult generate;
+        time_phase(generate, repeat, [&] {
+            OutputBuffer output(open("/dev/null", O_WRONLY | O_CLOEXEC));
+            AsmWriter writer(output);
+            Generator generator(prog.value(), &writer, opt_level);
+            generator.generate_prog();
+            return output.bytes_written();
+        });
+
+        print_phase(shape_name(shape), stmts, "tokenize", tokenize, "tokens");
+        print_phase(shape_name(shape), stmts, "parse", parse, "nodes");
+        print_phase(shape_name(shape), stmts, "generate", generate, "bytes");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+// Writes a synthetic Clear program to stdout, for feeding the compiler itself: ./clear_gen deep 100000 > deep.clr
+
+#include <iostream>
+#include <string_view>
+#include <cstdlib>
+
+#include "clr_gen.hpp"
+
+int main(int argc, char* argv[]) {
+    std::optional<Shape> shape;
+    if (argc >= 3 && argc <= 4) {
+        shape = parse_shape(argv[1]);
+    }
+    if (!shape.has_value()) {
+        std::cerr << "Incorrect call" << std::endl;
+        std::cerr << "Example: ./clear_gen <lets|chain|deep|idents> <statements> [seed] > out.clr" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const size_t stmts = std::strtoull(argv[2], nullptr, 10);
+    const uint64_t seed = argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 1;
+
+    std::cout << ClrGenerator(shape.value(), stmts, seed).generate();
+    return EXIT_SUCCESS;
+}
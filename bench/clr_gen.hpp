@@ -0,0 +1,140 @@
+// Contains the synthetic Clear program generator used by the benchmarks
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <optional>
+#include <cstdint>
+
+// what kind of program to generate, each one stresses a different part of the front end
+enum class Shape {
+    lets, // many short lets, mostly tokenizer / statement overhead
+    chain, // few statements with long operator chains, expression parsing and operand stacks
+    deep, // every let depends on the one before it, one long dependency chain through the whole program
+    idents, // many distinct long names, each expression references several earlier variables
+};
+
+inline constexpr Shape all_shapes[] = {Shape::lets, Shape::chain, Shape::deep, Shape::idents};
+
+[[nodiscard]] inline constexpr std::string_view shape_name(Shape shape) {
+    constexpr std::string_view names[] = {"lets", "chain", "deep", "idents"};
+    return names[static_cast<int>(shape)];
+}
+
+[[nodiscard]] inline std::optional<Shape> parse_shape(std::string_view name) {
+    for (Shape shape : all_shapes) {
+        if (shape_name(shape) == name) {
+            return shape;
+        }
+    }
+    return {};
+}
+
+// generates a valid Clear program of `stmts` statements (plus the final exit) of the given shape
+// the output only depends on the arguments, so runs with the same seed are comparable
+class ClrGenerator {
+public:
+    // terms per expression for Shape::chain
+    static constexpr int chain_length = 32;
+
+    inline ClrGenerator(Shape shape, size_t stmts, uint64_t seed = 1)
+        : m_shape(shape),
+        m_stmts(stmts),
+        m_state(seed * 0x9E3779B97F4A7C15ull + 1)
+    {
+    }
+
+    [[nodiscard]] std::string generate() {
+        m_out.clear();
+        m_out.reserve(m_stmts * 32);
+        for (size_t i = 0; i < m_stmts; i++) {
+            m_out += "let ";
+            append_name(i);
+            m_out += " = ";
+            switch (m_shape) {
+                case Shape::lets:
+                    append_term(i);
+                    append_op(false);
+                    append_int(next() % 100);
+                    break;
+                case Shape::chain:
+                    for (int term = 0; term < chain_length; term++) {
+                        if (term > 0) {
+                            append_op(true);
+                        }
+                        append_term(i);
+                    }
+                    break;
+                case Shape::deep:
+                    // the previous variable appears on both sides, so nothing can be dropped as dead
+                    if (i == 0) {
+                        m_out += "1";
+                        break;
+                    }
+                    append_name(i - 1);
+                    m_out += " * 3 - ";
+                    append_name(i - 1);
+                    m_out += " / 2";
+                    break;
+                case Shape::idents:
+                    for (int term = 0; term < 4; term++) {
+                        if (term > 0) {
+                            append_op(false);
+                        }
+                        append_term(i);
+                    }
+                    break;
+            }
+            m_out += ";\n";
+        }
+        m_out += "exit(";
+        if (m_stmts > 0) {
+            append_name(m_stmts - 1);
+        } else {
+            m_out += "0";
+        }
+        m_out += ");\n";
+        return std::move(m_out);
+    }
+
+private:
+    // splitmix64
+    uint64_t next() {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // a literal, or a variable declared before statement `i`
+    void append_term(size_t i) {
+        if (i == 0 || next() % 3 == 0) {
+            append_int(next() % 1000);
+        } else {
+            append_name(next() % i);
+        }
+    }
+
+    // + or -, and * as well when `all` is set. random divisions would collapse the values to zero and
+    // could divide by zero, only Shape::deep divides (by a constant)
+    void append_op(bool all) {
+        constexpr std::string_view ops[] = {" + ", " - ", " * "};
+        m_out += ops[next() % (all ? 3 : 2)];
+    }
+
+    void append_int(uint64_t value) {
+        m_out += std::to_string(value);
+    }
+
+    // Shape::idents uses long names so hashing and comparing them shows up
+    void append_name(size_t index) {
+        m_out += m_shape == Shape::idents ? "someRatherLongVariableName" : "v";
+        m_out += std::to_string(index);
+    }
+
+    // member vars
+    Shape m_shape;
+    size_t m_stmts;
+    uint64_t m_state;
+    std::string m_out;
+};
@@ -0,0 +1,349 @@
+// Generated code benchmark: compiles a corpus of programs and measures the executables they turn into, the
+// instructions they retire, their cycles, code size and stack use, against a checked in baseline
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <optional>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "resolve.hpp"
+#include "generation.hpp"
+#include "interp.hpp"
+#include "io.hpp"
+#include "clr_gen.hpp"
+
+// one corpus program compiled at one optimization level
+struct Measurement {
+    uint64_t instructions = 0; // retired in user mode, or counted statically without hardware counters
+    uint64_t cycles = 0; // user mode, fastest run. 0 when there are no hardware counters
+    uint64_t code_bytes = 0;
+    uint64_t stack_bytes = 0; // deepest stack address touched, below the rsp the program starts with
+    uint64_t memory_accesses = 0; // instructions that load or store, push and pop included
+};
+
+struct Program {
+    std::string name;
+    std::string source;
+};
+
+constexpr OptLevel opt_levels[] = {OptLevel::O0, OptLevel::O1, OptLevel::O2};
+
+[[nodiscard]] static std::string_view opt_name(OptLevel level) {
+    constexpr std::string_view names[] = {"O0", "O1", "O2"};
+    return names[static_cast<int>(level)];
+}
+
+// a user mode counter for `pid` that starts counting when it execs, -1 (with errno set) if there is none
+static int open_counter(pid_t pid, uint64_t config) {
+    perf_event_attr attr {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+// hardware counters are commonly missing in VMs and containers, or forbidden by kernel.perf_event_paranoid
+[[nodiscard]] static bool counters_available() {
+    const int fd = open_counter(0, PERF_COUNT_HW_INSTRUCTIONS);
+    if (fd < 0) {
+        std::cerr << "Hardware counters unavailable (" << strerror(errno)
+                  << "), falling back to static instruction counts" << std::endl;
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+struct RunResult {
+    int status = 0; // exit status, or 128 + the signal that killed the program
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+};
+
+// runs the executable at `path`, counting its instructions and cycles if `count` is set
+// the child waits on a pipe until the counters are attached, they start on its exec so nothing of the benchmark
+// itself is counted
+static RunResult run_program(const std::string& path, bool count) {
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+        fatal_error("Unable to create a pipe: ", strerror(errno));
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fatal_error("Unable to fork: ", strerror(errno));
+    }
+    if (pid == 0) {
+        char go;
+        close(ready[1]);
+        (void)!read(ready[0], &go, 1);
+        execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    close(ready[0]);
+    int counters[2] = {-1, -1};
+    if (count) {
+        counters[0] = open_counter(pid, PERF_COUNT_HW_INSTRUCTIONS);
+        counters[1] = open_counter(pid, PERF_COUNT_HW_CPU_CYCLES);
+    }
+    close(ready[1]); // releases the child
+    int wait_status = 0;
+    while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {
+    }
+
+    RunResult result;
+    result.status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+    uint64_t* values[2] = {&result.instructions, &result.cycles};
+    for (int i = 0; i < 2; i++) {
+        if (counters[i] >= 0) {
+            if (read(counters[i], values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+                *values[i] = 0;
+            }
+            close(counters[i]);
+        }
+    }
+    return result;
+}
+
+// the exit status the program has to end with, taken from the interpreter
+// a program that divides by zero is killed by SIGFPE
+[[nodiscard]] static int expected_status(const NodeProgram& prog) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fatal_error("Unable to fork: ", strerror(errno));
+    }
+    if (pid == 0) {
+        _exit(static_cast<int>(interpret(compile_bytecode(prog)) & 0xFF));
+    }
+    int wait_status = 0;
+    while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {
+    }
+    return WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+}
+
+// compiles `program` at `level` into an executable at `exe_path` and measures it
+// nullopt after printing a message if the executable does not exit the way the interpreter does
+static std::optional<Measurement> measure(const Program& program, OptLevel level, const std::string& exe_path,
+                                          bool count, int repeat) {
+    Tokenizer tokenizer(program.source);
+    std::vector<Token> tokens = tokenizer.tokenize();
+    std::optional<NodeProgram> prog = Parser(tokens, tokenizer.take_symbols()).parse_prog();
+    if (!prog.has_value()) {
+        fatal_error("Unable to parse ", program.name);
+    }
+    resolve_names(prog.value());
+
+    Measurement result;
+    CodeStats code_stats;
+    Generator(prog.value(), &code_stats, level).generate_prog();
+    result.instructions = code_stats.instructions();
+    result.code_bytes = code_stats.code_size();
+    result.stack_bytes = code_stats.stack_bytes();
+    result.memory_accesses = code_stats.memory_accesses();
+    {
+        OutputBuffer output(OutputBuffer::open_file(exe_path.c_str(), 0755));
+        ElfWriter writer(output);
+        Generator(prog.value(), &writer, level).generate_prog();
+    }
+
+    const int expected = expected_status(prog.value());
+    for (int run = 0; run < repeat; run++) {
+        const RunResult run_result = run_program(exe_path, count);
+        if (run_result.status != expected) {
+            std::cerr << program.name << " -" << opt_name(level) << ": exited with " << run_result.status
+                      << ", the interpreter with " << expected << std::endl;
+            return {};
+        }
+        if (count && run_result.instructions > 0) {
+            result.instructions = run == 0 ? run_result.instructions
+                                           : std::min(result.instructions, run_result.instructions);
+        }
+        if (count && run_result.cycles > 0) {
+            result.cycles = run == 0 || result.cycles == 0 ? run_result.cycles
+                                                           : std::min(result.cycles, run_result.cycles);
+        }
+    }
+    return result;
+}
+
+using Baseline = std::map<std::string, Measurement>; // keyed on "<program> <opt level>"
+
+// `# ` lines are comments, every other line is: program opt instructions cycles code_bytes stack_bytes memory_accesses
+static Baseline read_baseline(const std::string& path) {
+    Baseline baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line.starts_with('#')) {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string program;
+        std::string opt;
+        Measurement m;
+        if (fields >> program >> opt >> m.instructions >> m.cycles >> m.code_bytes >> m.stack_bytes
+            >> m.memory_accesses) {
+            baseline[program + ' ' + opt] = m;
+        }
+    }
+    return baseline;
+}
+
+static void write_baseline(const std::string& path, const Baseline& baseline) {
+    std::ofstream file(path);
+    file << "# written by ./clear_codegen_bench --update-baseline, cycles are 0 where there were no hardware counters\n";
+    file << "# program opt instructions cycles code_bytes stack_bytes memory_accesses\n";
+    for (const auto& [key, m] : baseline) {
+        file << key << ' ' << m.instructions << ' ' << m.cycles << ' ' << m.code_bytes << ' ' << m.stack_bytes << ' '
+             << m.memory_accesses << '\n';
+    }
+    if (!file) {
+        fatal_error("Unable to write '", path, "'");
+    }
+}
+
+// the change from `old_value` in percent, printed as "-" when there is nothing to compare against
+static std::string delta(uint64_t value, uint64_t old_value) {
+    if (old_value == 0 || value == 0) {
+        return "-";
+    }
+    std::ostringstream out;
+    out << std::showpos << std::fixed << std::setprecision(1)
+        << (static_cast<double>(value) - static_cast<double>(old_value)) * 100.0 / static_cast<double>(old_value)
+        << '%';
+    return out.str();
+}
+
+// true if `value` is more than `tolerance` percent above `old_value`
+[[nodiscard]] static bool regressed(uint64_t value, uint64_t old_value, double tolerance) {
+    return old_value > 0 && static_cast<double>(value) > static_cast<double>(old_value) * (1.0 + tolerance / 100.0);
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::filesystem::path> files;
+    std::string baseline_path;
+    bool update_baseline = false;
+    size_t stmts = 1000;
+    int repeat = 5;
+    double tolerance = 0.5;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "--corpus" && i + 1 < argc && std::filesystem::is_directory(argv[i + 1])) {
+            for (const auto& entry : std::filesystem::directory_iterator(argv[++i])) {
+                if (entry.path().extension() == ".clr") {
+                    files.push_back(entry.path());
+                }
+            }
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (arg == "--update-baseline") {
+            update_baseline = true;
+        } else if (arg == "--stmts" && i + 1 < argc) {
+            stmts = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = std::atof(argv[++i]);
+        } else if (!arg.starts_with('-')) {
+            files.emplace_back(arg);
+        } else {
+            std::cerr << "Incorrect call" << std::endl;
+            std::cerr << "Example: ./clear_codegen_bench [--corpus DIR] [--baseline FILE [--update-baseline]] "
+                         "[--stmts 1000] [--repeat 5] [--tolerance 0.5] [file.clr]..." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (update_baseline && baseline_path.empty()) {
+        std::cerr << "--update-baseline needs --baseline" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // the corpus files in name order, then one generated program of every shape
+    std::sort(files.begin(), files.end());
+    std::vector<Program> programs;
+    for (const std::filesystem::path& file : files) {
+        MappedFile source(file.c_str());
+        programs.push_back({file.stem().string(), std::string(source.view())});
+    }
+    for (Shape shape : all_shapes) {
+        programs.push_back({"gen-" + std::string(shape_name(shape)) + '-' + std::to_string(stmts),
+                            ClrGenerator(shape, stmts).generate()});
+    }
+
+    const bool count = counters_available();
+    const Baseline baseline = baseline_path.empty() ? Baseline() : read_baseline(baseline_path);
+    const std::string exe_path = (std::filesystem::temp_directory_path()
+        / ("clear-codegen-bench-" + std::to_string(getpid()))).string();
+
+    std::cout << "program               opt  " << (count ? "  instrs " : "  instrs*") << "      cycles  code bytes"
+              << " stack bytes   mem ops    instrs    cycles      code     stack" << std::endl;
+    Baseline results;
+    std::vector<std::string> failures;
+    for (const Program& program : programs) {
+        for (OptLevel level : opt_levels) {
+            const std::string key = program.name + ' ' + std::string(opt_name(level));
+            const std::optional<Measurement> m = measure(program, level, exe_path, count, repeat);
+            if (!m.has_value()) {
+                failures.push_back(key + ": wrong exit status");
+                continue;
+            }
+            results[key] = m.value();
+
+            const auto old = baseline.find(key);
+            const Measurement old_m = old == baseline.end() ? Measurement() : old->second;
+            std::cout << std::left << std::setw(22) << program.name << opt_name(level) << std::right
+                      << std::setw(11) << m->instructions << std::setw(12) << m->cycles << std::setw(12)
+                      << m->code_bytes << std::setw(12) << m->stack_bytes << std::setw(10) << m->memory_accesses
+                      << std::setw(10) << delta(m->instructions, old_m.instructions)
+                      << std::setw(10) << delta(m->cycles, old_m.cycles)
+                      << std::setw(10) << delta(m->code_bytes, old_m.code_bytes)
+                      << std::setw(10) << delta(m->stack_bytes, old_m.stack_bytes) << std::endl;
+
+            // cycles are too noisy to fail on, everything else is deterministic
+            if (regressed(m->instructions, old_m.instructions, tolerance)
+                || regressed(m->code_bytes, old_m.code_bytes, tolerance)
+                || regressed(m->stack_bytes, old_m.stack_bytes, tolerance)
+                || regressed(m->memory_accesses, old_m.memory_accesses, tolerance)) {
+                failures.push_back(key + ": worse than the baseline");
+            }
+        }
+    }
+    unlink(exe_path.c_str());
+    if (!count) {
+        std::cout << "* counted statically, the code is straight line so this is what runs up to the first exit"
+                  << std::endl;
+    }
+
+    // a baseline is only worth keeping if every program ran correctly
+    if (update_baseline && results.size() == programs.size() * std::size(opt_levels)) {
+        write_baseline(baseline_path, results);
+        std::cout << "Wrote " << results.size() << " entries to " << baseline_path << std::endl;
+        return EXIT_SUCCESS;
+    }
+    for (const std::string& failure : failures) {
+        std::cerr << failure << std::endl;
+    }
+    return failures.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,25 @@
+global _start
+_start:
+    mov rax, 5
+    push rax
+    push QWORD [rsp + 0]
+    mov rax, 2
+    imul rax, QWORD [rsp + 8]
+    pop rbx
+    add rax, rbx
+    sub rax, QWORD [rsp + 0]
+    push rax
+    mov rax, QWORD [rsp + 8]
+    sub rax, QWORD [rsp + 0]
+    push rax
+    mov rax, QWORD [rsp + 16]
+    imul rax, QWORD [rsp + 8]
+    pop rbx
+    add rax, rbx
+    push rax
+    mov rdi, QWORD [rsp + 0]
+    mov rax, 60
+    syscall
+    mov rax, 60
+    mov rdi, 0
+    syscall
@@ -0,0 +1,99 @@
+// Contains the textual (nasm syntax) backend, used with -S to inspect what the generator emits
+#pragma once
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <concepts>
+
+#include "x86.hpp"
+#include "io.hpp"
+
+class AsmWriter {
+public:
+    inline explicit AsmWriter(OutputBuffer& output)
+        : m_output(output)
+    {
+        m_output << "global _start\n_start:\n"; // starter assembly. independant of other circumstances
+    }
+
+    void write(std::span<const Instr> code) {
+        m_text.clear();
+        encode(code, m_text);
+        m_output.write(m_text);
+    }
+
+    // appends the nasm text of every instruction in `code` to `out`, pieces of a program are formatted by
+    // different threads this way and handed to write_encoded in order
+    static void encode(std::span<const Instr> code, std::string& out) {
+        for (const Instr& instr : code) {
+            write_instr(instr, out);
+        }
+    }
+
+    void write_encoded(std::span<const std::string> pieces) {
+        m_output.write(pieces);
+    }
+
+    void finish() {
+        m_output.flush();
+    }
+
+private:
+    template <std::integral T>
+    static void write_int(T value, std::string& out) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, static_cast<size_t>(result.ptr - digits));
+    }
+
+    // lea only computes an address, nasm takes its memory operand without a size
+    static void write_operand(const Operand& operand, std::string& out, bool sized = true) {
+        switch (operand.kind) {
+            case Operand::Kind::none:
+                break;
+            case Operand::Kind::reg:
+                out += reg_name(operand.reg);
+                break;
+            case Operand::Kind::imm:
+                write_int(operand.imm, out);
+                break;
+            case Operand::Kind::mem:
+                out += sized ? "QWORD [" : "[";
+                out += reg_name(operand.reg);
+                if (operand.has_index()) {
+                    out += " + ";
+                    out += reg_name(operand.index);
+                    out += '*';
+                    write_int(static_cast<int>(operand.scale), out);
+                }
+                if (operand.disp < 0) {
+                    out += " - ";
+                    write_int(-static_cast<int64_t>(operand.disp), out);
+                } else {
+                    out += " + ";
+                    write_int(operand.disp, out);
+                }
+                out += ']';
+                break;
+        }
+    }
+
+    static void write_instr(const Instr& instr, std::string& out) {
+        out += "    ";
+        out += op_name(instr.op);
+        if (instr.dst.kind != Operand::Kind::none) {
+            out += ' ';
+            write_operand(instr.dst, out);
+        }
+        if (instr.src.kind != Operand::Kind::none) {
+            out += ", ";
+            write_operand(instr.src, out, instr.op != Op::lea);
+        }
+        out += '\n';
+    }
+
+    OutputBuffer& m_output;
+    std::string m_text; // the text of the chunk being written, reused between chunks
+};
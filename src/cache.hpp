@@ -0,0 +1,313 @@
+// Contains the on-disk compilation cache: the outputs of a compile are stored under a hash of the source, the compiler
+// and the flags, and copied back instead of compiling when the same inputs come around again
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// XXH64 (Yann Collet), four independent lanes of 8 bytes so the source is hashed at several GB/s
+[[nodiscard]] inline uint64_t hash_bytes(std::string_view data, uint64_t seed = 0) {
+    constexpr uint64_t p1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t p2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t p3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t p4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t p5 = 0x27D4EB2F165667C5ull;
+    const auto read64 = [](const char* p) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    };
+    const auto read32 = [](const char* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return static_cast<uint64_t>(v);
+    };
+    const auto round = [](uint64_t acc, uint64_t input) {
+        return std::rotl(acc + input * p2, 31) * p1;
+    };
+    const auto merge = [&](uint64_t acc, uint64_t lane) {
+        return (acc ^ round(0, lane)) * p1 + p4;
+    };
+
+    const char* p = data.data();
+    const char* const end = p + data.size();
+    uint64_t h;
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + p1 + p2;
+        uint64_t v2 = seed + p2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - p1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + p5;
+    }
+    h += data.size();
+
+    for (; end - p >= 8; p += 8) {
+        h = std::rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+    }
+    if (end - p >= 4) {
+        h = std::rotl(h ^ read32(p) * p1, 23) * p2 + p3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = std::rotl(h ^ static_cast<unsigned char>(*p) * p5, 11) * p1;
+    }
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+// maps a key to the files one compile produced (the executable, the nasm text and the object file)
+// every entry is a directory named after its key holding copies of those files, named by their position in the list
+// the caller passes, which the output mode in the key fixes, and a copy of the source. the key is only a 64-bit hash
+// and sources with the same hash are easy to make on purpose, so a hit has to match that copy byte for byte. a hit
+// refreshes the entry's modification time. the cache keeps a running estimate of its size and once that grows past
+// the limit the least recently used entries are evicted
+// the cache is only ever an optimization: any failure to read or write it is treated as a miss, never as an error,
+// and entries are published with a rename so concurrent compilers never see half written ones
+class CompileCache {
+public:
+    static constexpr uint64_t default_max_bytes = 256ull * 1024 * 1024; // 256mb
+    // bump when the layout of an entry changes
+    static constexpr std::string_view format_version = "4";
+
+    inline explicit CompileCache(std::filesystem::path dir, uint64_t max_bytes = default_max_bytes)
+        : m_dir(std::move(dir)),
+        m_max_bytes(max_bytes)
+    {
+    }
+
+    // $XDG_CACHE_HOME/clear, or ~/.cache/clear. empty if neither variable is set
+    [[nodiscard]] static std::filesystem::path default_dir() {
+        if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg != nullptr && xdg[0] != '\0') {
+            return std::filesystem::path(xdg) / "clear";
+        }
+        if (const char* home = getenv("HOME"); home != nullptr && home[0] != '\0') {
+            return std::filesystem::path(home) / ".cache" / "clear";
+        }
+        return {};
+    }
+
+    // the key for compiling `source` with the flags spelled out in `options`
+    // the running compiler binary is identified by its size, inode and modification time, so rebuilding the
+    // compiler invalidates everything it cached before without hashing the binary on every run
+    [[nodiscard]] static std::string key(std::string_view source, std::string_view options) {
+        std::string config(format_version);
+        struct stat exe {};
+        if (stat("/proc/self/exe", &exe) == 0) {
+            config += ' ' + std::to_string(exe.st_size) + ' ' + std::to_string(exe.st_ino) + ' '
+                + std::to_string(exe.st_mtim.tv_sec) + '.' + std::to_string(exe.st_mtim.tv_nsec);
+        }
+        config += ' ';
+        config += options;
+        const uint64_t source_hash = hash_bytes(source);
+        return hex(source_hash) + hex(hash_bytes(config, source_hash));
+    }
+
+    // copies the files of entry `key` to `files`, false if there is no complete entry compiled from `source`
+    [[nodiscard]] bool restore(
+        const std::string& key, std::string_view source, std::span<const std::filesystem::path> files) const {
+        std::error_code ec;
+        const std::filesystem::path entry = m_dir / key;
+        if (!std::filesystem::is_directory(entry, ec) || !holds(entry / source_file, source)) {
+            return false;
+        }
+        for (size_t i = 0; i < files.size(); i++) {
+            // unlinked first, like OutputBuffer::open_file, so an executable that is still running can be replaced
+            std::filesystem::remove(files[i], ec);
+            if (!std::filesystem::copy_file(entry / std::to_string(i), files[i], ec)) {
+                return false;
+            }
+        }
+        std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // stores copies of `files` as entry `key` compiled from `source`, then evicts if the cache has grown past its size
+    // limit
+    void store(const std::string& key, std::string_view source, std::span<const std::filesystem::path> files) const {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+        const std::filesystem::path staging = m_dir / (std::string(staging_prefix) + key + '.' + std::to_string(getpid()));
+        if (!std::filesystem::create_directory(staging, ec)) {
+            return;
+        }
+        uint64_t bytes = source.size();
+        for (size_t i = 0; i < files.size(); i++) {
+            if (!std::filesystem::copy_file(files[i], staging / std::to_string(i), ec)) {
+                std::filesystem::remove_all(staging, ec);
+                return;
+            }
+            bytes += std::filesystem::file_size(files[i], ec);
+        }
+        if (!write_file(staging / source_file, source)) {
+            std::filesystem::remove_all(staging, ec);
+            return;
+        }
+        // fails if another compiler published the same entry first, theirs is just as good
+        std::filesystem::rename(staging, m_dir / key, ec);
+        if (ec) {
+            std::filesystem::remove_all(staging, ec);
+            return;
+        }
+
+        // the estimate only grows here and is set to the real size by evict. compilers storing at the same time can
+        // lose each other's additions, which only delays an eviction until the next store
+        const uint64_t total = read_number(m_dir / size_file) + bytes;
+        if (total > m_max_bytes) {
+            evict();
+        } else {
+            write_number(m_dir / size_file, total);
+        }
+    }
+
+private:
+    static constexpr std::string_view staging_prefix = "tmp.";
+    // in every entry, a copy of the source it was compiled from
+    static constexpr std::string_view source_file = "source";
+    // in the cache directory, the estimated bytes of all entries
+    static constexpr std::string_view size_file = "size";
+    // a staging directory this old belongs to a compiler that was killed while storing, younger ones may still be
+    // filled and published
+    static constexpr std::chrono::hours stale_staging_age {1};
+
+    // true if the file at `path` holds exactly `data`
+    [[nodiscard]] static bool holds(const std::filesystem::path& path, std::string_view data) {
+        std::error_code ec;
+        if (std::filesystem::file_size(path, ec) != data.size() || ec) {
+            return false;
+        }
+        std::ifstream in(path, std::ios::binary);
+        char buffer[64 * 1024];
+        for (size_t offset = 0; offset < data.size();) {
+            const size_t size = std::min(sizeof(buffer), data.size() - offset);
+            in.read(buffer, static_cast<std::streamsize>(size));
+            if (!in || memcmp(buffer, data.data() + offset, size) != 0) {
+                return false;
+            }
+            offset += size;
+        }
+        return true;
+    }
+
+    static bool write_file(const std::filesystem::path& path, std::string_view data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        return static_cast<bool>(out.write(data.data(), static_cast<std::streamsize>(data.size())));
+    }
+
+    // the decimal number in `path`, 0 if it is missing or unreadable
+    [[nodiscard]] static uint64_t read_number(const std::filesystem::path& path) {
+        std::ifstream in(path);
+        uint64_t value = 0;
+        if (!(in >> value)) {
+            return 0;
+        }
+        return value;
+    }
+
+    // replaces `path` with a file holding `value`. written next to it and renamed over it, so readers see either the
+    // old or the new number. the temporary name is unique per call, batch mode stores from several threads at once
+    static bool write_number(const std::filesystem::path& path, uint64_t value) {
+        static std::atomic<uint64_t> writes = 0;
+        std::filesystem::path temp = path;
+        temp += '.' + std::to_string(getpid()) + '.' + std::to_string(writes.fetch_add(1, std::memory_order_relaxed));
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            if (!(out << value)) {
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    [[nodiscard]] static std::string hex(uint64_t value) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string out(16, '0');
+        for (int i = 15; i >= 0; i--) {
+            out[static_cast<size_t>(i)] = digits[value & 0xF];
+            value >>= 4;
+        }
+        return out;
+    }
+
+    // removes the least recently used entries until the cache fits in m_max_bytes and records the size that is left
+    // staging directories are skipped, other compilers may be about to publish them, unless they are stale
+    void evict() const {
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type used;
+            uint64_t bytes = 0;
+        };
+        std::error_code ec;
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        const auto now = std::filesystem::file_time_type::clock::now();
+        for (const auto& dir : std::filesystem::directory_iterator(m_dir, ec)) {
+            if (!dir.is_directory(ec)) {
+                continue;
+            }
+            Entry entry {.path = dir.path(), .used = dir.last_write_time(ec)};
+            if (entry.path.filename().string().starts_with(staging_prefix)) {
+                if (!ec && now - entry.used > stale_staging_age) {
+                    std::filesystem::remove_all(entry.path, ec);
+                }
+                continue;
+            }
+            for (const auto& file : std::filesystem::directory_iterator(dir.path(), ec)) {
+                const uintmax_t bytes = file.file_size(ec);
+                if (!ec) {
+                    entry.bytes += bytes;
+                }
+            }
+            total += entry.bytes;
+            entries.push_back(std::move(entry));
+        }
+        if (total > m_max_bytes) {
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+            for (const Entry& entry : entries) {
+                if (total <= m_max_bytes) {
+                    break;
+                }
+                std::filesystem::remove_all(entry.path, ec);
+                total -= entry.bytes;
+            }
+        }
+        write_number(m_dir / size_file, total);
+    }
+
+    // member vars
+    std::filesystem::path m_dir;
+    uint64_t m_max_bytes;
+};
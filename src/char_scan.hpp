@@ -0,0 +1,199 @@
+// Contains the character classification used by the tokenizer and the vectorized scanners that skip runs of a class
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// what a source byte can start, locale independent unlike <cctype>
+enum class CharClass : uint8_t {
+    illegal,
+    space,
+    alpha,
+    digit,
+    symbol,
+};
+
+// classes a run can be skipped over for
+enum class CharRun : uint8_t {
+    space, // ' ', \t, \n, \v, \f, \r
+    alnum, // identifier continuation: letters and digits
+    digit,
+};
+
+inline constexpr std::array<CharClass, 256> char_classes = [] {
+    std::array<CharClass, 256> table {};
+    for (int c = 0; c < 256; c++) {
+        if (c == ' ' || (c >= '\t' && c <= '\r')) {
+            table[c] = CharClass::space;
+        } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            table[c] = CharClass::alpha;
+        } else if (c >= '0' && c <= '9') {
+            table[c] = CharClass::digit;
+        }
+    }
+    for (char c : {'(', ')', ';', '=', '+', '*', '-', '/'}) {
+        table[static_cast<unsigned char>(c)] = CharClass::symbol;
+    }
+    return table;
+}();
+
+[[nodiscard]] inline constexpr CharClass char_class(char c) {
+    return char_classes[static_cast<unsigned char>(c)];
+}
+
+[[nodiscard]] inline constexpr bool in_run(CharRun run, char c) {
+    const CharClass cls = char_class(c);
+    switch (run) {
+        case CharRun::space:
+            return cls == CharClass::space;
+        case CharRun::alnum:
+            return cls == CharClass::alpha || cls == CharClass::digit;
+        default:
+            return cls == CharClass::digit;
+    }
+}
+
+// scalar fallback, also used for the tail that is too short for a vector load
+[[nodiscard]] inline const char* scan_run_scalar(CharRun run, const char* p, const char* end) {
+    while (p < end && in_run(run, *p)) {
+        p++;
+    }
+    return p;
+}
+
+#if defined(__x86_64__)
+
+// byte wise lo <= c <= hi with a single signed compare: shifting the range down to start at -128 turns it into c' < limit
+[[nodiscard]] inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+    const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(-128 - lo)));
+    return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + (hi - lo + 1))));
+}
+
+[[nodiscard]] __attribute__((target("avx2"))) inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+    const __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(static_cast<char>(-128 - lo)));
+    return _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + (hi - lo + 1))), shifted);
+}
+
+// 16 bytes per step, SSE2 is part of x86-64 so this needs no dispatch
+[[nodiscard]] inline const char* scan_run_sse2(CharRun run, const char* p, const char* end) {
+    while (end - p >= 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i match;
+        if (run == CharRun::space) {
+            match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+        } else {
+            match = in_range_sse2(v, '0', '9');
+            if (run == CharRun::alnum) {
+                // setting bit 5 folds upper case letters onto lower case ones
+                match = _mm_or_si128(match, in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+            }
+        }
+        const auto mismatch = static_cast<uint32_t>(~_mm_movemask_epi8(match) & 0xFFFF);
+        if (mismatch != 0) {
+            return p + __builtin_ctz(mismatch);
+        }
+        p += 16;
+    }
+    return scan_run_scalar(run, p, end);
+}
+
+// 32 bytes per step, only called once the cpu is known to support AVX2
+[[nodiscard]] __attribute__((target("avx2"))) inline const char* scan_run_avx2(CharRun run, const char* p, const char* end) {
+    while (end - p >= 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i match;
+        if (run == CharRun::space) {
+            match = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+        } else {
+            match = in_range_avx2(v, '0', '9');
+            if (run == CharRun::alnum) {
+                match = _mm256_or_si256(match, in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'));
+            }
+        }
+        const auto mismatch = ~static_cast<uint32_t>(_mm256_movemask_epi8(match));
+        if (mismatch != 0) {
+            return p + __builtin_ctz(mismatch);
+        }
+        p += 32;
+    }
+    return scan_run_sse2(run, p, end);
+}
+
+// bitmasks of the space and alnum bytes in a 32 byte block
+struct BlockMasks {
+    uint32_t space;
+    uint32_t alnum;
+};
+
+[[nodiscard]] __attribute__((target("avx2"))) inline BlockMasks block_masks_avx2(const char* p) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+    const __m256i alnum = _mm256_or_si256(in_range_avx2(v, '0', '9'),
+                                          in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'));
+    return {static_cast<uint32_t>(_mm256_movemask_epi8(space)), static_cast<uint32_t>(_mm256_movemask_epi8(alnum))};
+}
+
+[[nodiscard]] inline BlockMasks block_masks_sse2(const char* p) {
+    BlockMasks masks {};
+    for (int half = 0; half < 2; half++) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + half * 16));
+        const __m128i space = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+        const __m128i alnum = _mm_or_si128(in_range_sse2(v, '0', '9'),
+                                           in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+        masks.space |= static_cast<uint32_t>(_mm_movemask_epi8(space)) << (half * 16);
+        masks.alnum |= static_cast<uint32_t>(_mm_movemask_epi8(alnum)) << (half * 16);
+    }
+    return masks;
+}
+
+inline const bool cpu_has_avx2 = __builtin_cpu_supports("avx2");
+
+#endif
+
+// counts the tokens in `src` closely enough to size the token buffer in one allocation: every byte that is neither
+// space nor alnum starts a token, and so does every alnum byte that does not follow another one. the only miss is
+// a literal running into an identifier (`12ab`), which the tokenizer splits in two
+[[nodiscard]] inline size_t estimate_token_count(std::string_view src) {
+    const char* p = src.data();
+    const char* const end = p + src.size();
+    size_t count = 0;
+    bool prev_alnum = false;
+#if defined(__x86_64__)
+    while (end - p >= 32) {
+        const BlockMasks masks = cpu_has_avx2 ? block_masks_avx2(p) : block_masks_sse2(p);
+        const uint32_t alnum_starts = masks.alnum & ~(masks.alnum << 1 | static_cast<uint32_t>(prev_alnum));
+        count += static_cast<size_t>(__builtin_popcount(~(masks.space | masks.alnum)) + __builtin_popcount(alnum_starts));
+        prev_alnum = (masks.alnum >> 31) != 0;
+        p += 32;
+    }
+#endif
+    for (; p < end; p++) {
+        const CharClass cls = char_class(*p);
+        const bool alnum = cls == CharClass::alpha || cls == CharClass::digit;
+        count += (cls != CharClass::space && !alnum) || (alnum && !prev_alnum);
+        prev_alnum = alnum;
+    }
+    return count;
+}
+
+// returns the first position in [p, end) whose char is not part of `run`, or end
+// most runs are a few bytes long, so the first bytes are checked one by one before any vector is loaded
+[[nodiscard]] inline const char* scan_run(CharRun run, const char* p, const char* end) {
+    for (int i = 0; i < 4; i++) {
+        if (p == end || !in_run(run, *p)) {
+            return p;
+        }
+        p++;
+    }
+#if defined(__x86_64__)
+    return cpu_has_avx2 ? scan_run_avx2(run, p, end) : scan_run_sse2(run, p, end);
+#else
+    return scan_run_scalar(run, p, end);
+#endif
+}
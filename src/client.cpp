@@ -0,0 +1,72 @@
+// Thin client for `clear --server`: takes the same arguments as clear, hands them to the server together with its
+// working directory, stdout and stderr, and exits with the status of the compile. when no server is running it execs
+// the clear binary next to it instead, so a build can always call clear_client
+// starting the client is the whole per compile overhead left, so it is linked statically where the toolchain has a
+// static libc (loading libstdc++ alone costs more than a small compile) and stays away from iostreams and their
+// static initialization
+
+#include <string>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+
+// prints `parts` to stderr and exits
+template <typename... Parts>
+[[noreturn]] static void fail(const Parts&... parts) {
+    std::string message;
+    ((message += parts), ...);
+    message += '\n';
+    (void)write_exact(STDERR_FILENO, message.data(), message.size());
+    exit(EXIT_FAILURE);
+}
+
+// replaces this process with the compiler installed next to the client
+[[noreturn]] static void exec_compiler(char* argv[]) {
+    char self[PATH_MAX];
+    const ssize_t size = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    std::string path = size > 0 ? std::string(self, static_cast<size_t>(size)) : std::string("clear_client");
+    path = path.substr(0, path.rfind('/') + 1) + "clear";
+    argv[0] = path.data();
+    execv(path.c_str(), argv);
+    fail("Unable to run '", path, "': ", strerror(errno));
+}
+
+int main(int argc, char* argv[]) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        fail("Unable to get the working directory: ", strerror(errno));
+    }
+    std::string payload(cwd);
+    payload += '\0';
+    for (int i = 1; i < argc; i++) {
+        payload += argv[i];
+        payload += '\0';
+    }
+
+    sockaddr_un addr {};
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || !socket_address(default_socket_path(), addr)
+        || connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0) {
+        exec_compiler(argv);
+    }
+    if (!peer_is_same_user(sock)) {
+        fail("The clear server on ", default_socket_path(), " runs as another user, not sending it anything");
+    }
+
+    if (!send_request(sock, payload, STDOUT_FILENO, STDERR_FILENO)) {
+        fail("Unable to send the request to the clear server: ", strerror(errno));
+    }
+    int32_t status = 0;
+    if (!read_exact(sock, &status, sizeof(status))) {
+        fail("The clear server closed the connection without an exit status");
+    }
+    return status;
+}
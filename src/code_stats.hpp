@@ -0,0 +1,110 @@
+// Contains a code sink that measures the generated code instead of writing it anywhere, used by the codegen benchmark
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <cstdint>
+
+#include "x86.hpp"
+#include "encoder.hpp"
+
+// counts instructions, encoded bytes and memory operands, and follows rsp and rbp through the code to find the
+// deepest stack address it touches. clear programs are straight line code, so the static counts are what runs up to
+// the first exit
+class CodeStats {
+public:
+    void write(std::span<const Instr> code) {
+        uint8_t bytes[X86Encoder::max_instr_size];
+        for (const Instr& instr : code) {
+            m_instructions++;
+            m_code_size += X86Encoder::encode(instr, bytes);
+            track_stack(instr);
+        }
+    }
+
+    void finish() {
+    }
+
+    [[nodiscard]] inline uint64_t instructions() const {
+        return m_instructions;
+    }
+
+    // bytes of machine code
+    [[nodiscard]] inline uint64_t code_size() const {
+        return m_code_size;
+    }
+
+    // instructions that load or store memory, push and pop included
+    [[nodiscard]] inline uint64_t memory_accesses() const {
+        return m_memory_accesses;
+    }
+
+    // how far below its starting rsp the code reads or writes the stack
+    [[nodiscard]] inline uint64_t stack_bytes() const {
+        return static_cast<uint64_t>(m_max_depth);
+    }
+
+private:
+    // `depth` is the distance below the starting rsp
+    void touch(int64_t depth) {
+        m_max_depth = std::max(m_max_depth, depth);
+    }
+
+    // the depth of the lowest byte a memory operand addresses, only rsp and rbp bases are followed
+    void touch(const Operand& operand) {
+        if (operand.reg == Reg::rsp) {
+            touch(m_rsp_depth - operand.disp);
+        } else if (operand.reg == Reg::rbp) {
+            touch(m_rbp_depth - operand.disp);
+        }
+    }
+
+    void track_stack(const Instr& instr) {
+        const bool accesses_mem = instr.op != Op::lea && (instr.dst.is_mem() || instr.src.is_mem());
+        if (accesses_mem || instr.op == Op::push || instr.op == Op::pop) {
+            m_memory_accesses++;
+        }
+        if (accesses_mem) {
+            touch(instr.dst.is_mem() ? instr.dst : instr.src);
+        }
+
+        const bool dst_rsp = instr.dst.is_reg() && instr.dst.reg == Reg::rsp;
+        switch (instr.op) {
+            case Op::push:
+                m_rsp_depth += 8;
+                touch(m_rsp_depth);
+                break;
+            case Op::pop:
+                m_rsp_depth -= 8;
+                break;
+            case Op::sub:
+                if (dst_rsp && instr.src.is_imm()) {
+                    m_rsp_depth += instr.src.imm;
+                }
+                break;
+            case Op::add:
+                if (dst_rsp && instr.src.is_imm()) {
+                    m_rsp_depth -= instr.src.imm;
+                }
+                break;
+            case Op::mov:
+                if (dst_rsp && instr.src.is_reg() && instr.src.reg == Reg::rbp) {
+                    m_rsp_depth = m_rbp_depth;
+                } else if (instr.dst.is_reg() && instr.dst.reg == Reg::rbp && instr.src.is_reg()
+                    && instr.src.reg == Reg::rsp) {
+                    m_rbp_depth = m_rsp_depth;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    // member vars
+    uint64_t m_instructions = 0;
+    uint64_t m_code_size = 0;
+    uint64_t m_memory_accesses = 0;
+    int64_t m_rsp_depth = 0;
+    int64_t m_rbp_depth = 0;
+    int64_t m_max_depth = 0;
+};
@@ -0,0 +1,46 @@
+// Contains the fatal error reporting shared by the phases of the compiler
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+// thrown instead of exiting while parsing speculatively, see front_end_error
+struct FrontEndError {};
+
+// thrown instead of exiting while compiling one file of a batch (-o), holds the message that would have been printed
+struct CompileError {
+    std::string message;
+};
+
+// set on threads parsing a chunk of the source for the parallel front end
+inline thread_local bool t_speculative = false;
+
+// set on threads compiling a file of a batch
+inline thread_local bool t_batch = false;
+
+// prints the concatenation of `parts` and exits, how every error in the program being compiled is reported
+// a file of a batch must not take the other files down with it, its error is thrown as a CompileError instead and
+// the driver reports it once the batch is done
+template <typename... Parts>
+[[noreturn]] inline void fatal_error(const Parts&... parts) {
+    if (t_batch) {
+        std::ostringstream message;
+        (message << ... << parts);
+        throw CompileError {message.str()};
+    }
+    (std::cerr << ... << parts) << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// fatal_error for the tokenizer and parser
+// a speculative chunk parse must not print or exit (another chunk may hold an earlier error), it throws instead
+// and the caller reruns the serial front end, which then reports the first error in the source
+template <typename... Parts>
+[[noreturn]] inline void front_end_error(const Parts&... parts) {
+    if (t_speculative) {
+        throw FrontEndError {};
+    }
+    fatal_error(parts...);
+}
@@ -0,0 +1,109 @@
+// Contains the writer for static ELF64 executables, so no assembler or linker is needed
+#pragma once
+
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+#include <elf.h>
+
+#include "x86.hpp"
+#include "encoder.hpp"
+#include "io.hpp"
+
+// streams encoded machine code into an executable made of a single read + execute PT_LOAD segment, plus a
+// PT_GNU_STACK header for a read + write stack (without one some kernels and loaders make the stack executable)
+// the headers are written up front with placeholder sizes and patched in finish()
+class ElfWriter {
+public:
+    static constexpr uint64_t base_addr = 0x400000;
+    static constexpr uint64_t program_header_count = 2;
+    static constexpr uint64_t header_size = sizeof(Elf64_Ehdr) + program_header_count * sizeof(Elf64_Phdr);
+    static constexpr uint64_t entry_addr = base_addr + header_size; // code starts right after the headers
+
+    inline explicit ElfWriter(OutputBuffer& output)
+        : m_output(output)
+    {
+        write_headers(0);
+    }
+
+    void write(std::span<const Instr> code) {
+        uint8_t bytes[X86Encoder::max_instr_size];
+        for (const Instr& instr : code) {
+            const size_t size = X86Encoder::encode(instr, bytes);
+            m_output.write({reinterpret_cast<const char*>(bytes), size});
+            m_code_size += size;
+        }
+    }
+
+    // pieces of the program encoded by X86Encoder::encode, possibly on other threads, in program order
+    static void encode(std::span<const Instr> code, std::string& out) {
+        X86Encoder::encode(code, out);
+    }
+
+    void write_encoded(std::span<const std::string> pieces) {
+        m_output.write(pieces);
+        for (const std::string& piece : pieces) {
+            m_code_size += piece.size();
+        }
+    }
+
+    void finish() {
+        const size_t offset = m_output.bytes_written() - header_size - m_code_size;
+        write_headers(m_code_size, offset);
+    }
+
+    // bytes of machine code written so far
+    [[nodiscard]] inline size_t code_size() const {
+        return m_code_size;
+    }
+
+private:
+    // writes the headers, or patches them in at `patch_offset` once the size of the code is known
+    void write_headers(uint64_t code_size, size_t patch_offset = SIZE_MAX) {
+        Elf64_Ehdr ehdr {};
+        memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_EXEC;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = entry_addr;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = program_header_count;
+
+        // the whole file, headers included, is mapped at base_addr
+        Elf64_Phdr phdr {};
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_offset = 0;
+        phdr.p_vaddr = base_addr;
+        phdr.p_paddr = base_addr;
+        phdr.p_filesz = header_size + code_size;
+        phdr.p_memsz = header_size + code_size;
+        phdr.p_align = 0x1000;
+
+        Elf64_Phdr stack {};
+        stack.p_type = PT_GNU_STACK;
+        stack.p_flags = PF_R | PF_W;
+        stack.p_align = 0x10;
+
+        char headers[header_size];
+        memcpy(headers, &ehdr, sizeof(ehdr));
+        memcpy(headers + sizeof(ehdr), &phdr, sizeof(phdr));
+        memcpy(headers + sizeof(ehdr) + sizeof(phdr), &stack, sizeof(stack));
+        if (patch_offset == SIZE_MAX) {
+            m_output.write({headers, header_size});
+        } else {
+            m_output.patch(patch_offset, headers, header_size);
+        }
+    }
+
+    OutputBuffer& m_output;
+    size_t m_code_size = 0;
+};
@@ -0,0 +1,179 @@
+// Contains the compile time front end for Clear programs embedded in C++: the C++ compiler tokenizes, parses and
+// evaluates them, so nothing of the compiler runs when the program using them starts
+//
+//     static_assert(clear::evaluate<"let x = 1 + 2; exit(x);">() == 3);
+//     constexpr auto code = clear::compile<"let x = 1 + 2; exit(x);">(); // std::array<uint8_t, N>
+//
+// errors in an embedded program fail the C++ build, the diagnostic points at the front end's message
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "resolve.hpp"
+#include "x86.hpp"
+#include "encoder.hpp"
+
+namespace clear {
+
+// a string literal as a template argument: compile<"exit(0);">()
+template <size_t N>
+struct Source {
+    char text[N] {};
+
+    consteval Source(const char (&str)[N]) {
+        std::copy_n(str, N, text);
+    }
+
+    [[nodiscard]] constexpr std::string_view view() const {
+        return {text, N - 1};
+    }
+};
+
+// the tokens of `src`, the same ones Tokenizer::tokenize produces. identifiers are interned into `symbols` with a
+// linear search, an embedded program has a handful of names and the hash table is not constexpr
+[[nodiscard]] constexpr std::vector<Token> tokenize(std::string_view src, std::vector<std::string_view>& symbols) {
+    std::vector<Token> tokens;
+    size_t i = 0;
+    // the end of the run of `run` characters starting at i
+    const auto scan = [&](CharRun run) {
+        size_t end = i + 1;
+        while (end < src.size() && in_run(run, src[end])) {
+            end++;
+        }
+        return end;
+    };
+    while (i < src.size()) {
+        switch (char_class(src[i])) {
+            case CharClass::space:
+                i = scan(CharRun::space);
+                break;
+            case CharClass::alpha: {
+                const size_t end = scan(CharRun::alnum);
+                const std::string_view word = src.substr(i, end - i);
+                if (auto type = keyword(word)) {
+                    tokens.push_back({.type = type.value(), .symbol = 0, .value = {}});
+                } else {
+                    const auto symbol = static_cast<uint32_t>(
+                        std::find(symbols.begin(), symbols.end(), word) - symbols.begin());
+                    if (symbol == symbols.size()) {
+                        symbols.push_back(word);
+                    }
+                    tokens.push_back({.type = TokenType::ident, .symbol = symbol, .value = word});
+                }
+                i = end;
+                break;
+            }
+            case CharClass::digit: {
+                const size_t end = scan(CharRun::digit);
+                tokens.push_back({.type = TokenType::int_lit, .symbol = 0, .value = src.substr(i, end - i)});
+                i = end;
+                break;
+            }
+            case CharClass::symbol:
+                tokens.push_back({.type = symbol_tokens[static_cast<unsigned char>(src[i])], .symbol = 0, .value = {}});
+                i++;
+                break;
+            case CharClass::illegal:
+                front_end_error("Illegal character: ", src[i]);
+        }
+    }
+    return tokens;
+}
+
+// the value `prog` passes to exit, 0 if it never exits. arithmetic wraps like the generated code's
+// `prog` must have been resolved (resolve_names). a division the hardware would trap on is an error
+[[nodiscard]] constexpr int64_t evaluate(const NodeProgram& prog) {
+    std::vector<int64_t> vars(prog.symbols.size(), 0);
+    std::vector<int64_t> stack;
+    for (uint32_t index = 0; index < prog.node_count(); index++) {
+        const NodeKind kind = prog.kinds[index];
+        if (is_bin_expr(kind)) {
+            const auto rhs = static_cast<uint64_t>(stack.back());
+            stack.pop_back();
+            const auto lhs = static_cast<uint64_t>(stack.back());
+            switch (kind) {
+                case NodeKind::add:
+                    stack.back() = static_cast<int64_t>(lhs + rhs);
+                    break;
+                case NodeKind::sub:
+                    stack.back() = static_cast<int64_t>(lhs - rhs);
+                    break;
+                case NodeKind::mul:
+                    stack.back() = static_cast<int64_t>(lhs * rhs);
+                    break;
+                default:
+                    if (rhs == 0 || (static_cast<int64_t>(lhs) == INT64_MIN && static_cast<int64_t>(rhs) == -1)) {
+                        fatal_error("Division overflows or divides by zero");
+                    }
+                    stack.back() = static_cast<int64_t>(lhs) / static_cast<int64_t>(rhs);
+                    break;
+            }
+            continue;
+        }
+        switch (kind) {
+            case NodeKind::int_lit:
+                stack.push_back(prog.int_lits[prog.lhs[index]]);
+                break;
+            case NodeKind::ident:
+                stack.push_back(vars[prog.lhs[index]]);
+                break;
+            case NodeKind::stmt_let:
+                vars[prog.rhs[index]] = stack.back();
+                stack.pop_back();
+                break;
+            case NodeKind::stmt_exit:
+                return stack.back();
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+// runs the whole front end on `src` and evaluates the program
+[[nodiscard]] constexpr int64_t evaluate(std::string_view src) {
+    std::vector<std::string_view> symbols;
+    std::vector<Token> tokens = tokenize(src, symbols);
+    std::optional<NodeProgram> prog = Parser(std::move(tokens), std::move(symbols)).parse_prog();
+    if (!prog.has_value()) {
+        front_end_error("Unable to parse tokens");
+    }
+    resolve_names(prog.value());
+    return evaluate(prog.value());
+}
+
+// the value the program passes to exit, as a constant
+template <Source src>
+[[nodiscard]] consteval int64_t evaluate() {
+    return evaluate(src.view());
+}
+
+// encodes `int64_t f()` returning `value` into `out` (at least 2 * X86Encoder::max_instr_size bytes) and returns the
+// number of bytes written
+constexpr size_t encode_return(int64_t value, uint8_t* out) {
+    size_t size = X86Encoder::encode({.op = Op::mov, .dst = Operand::r(Reg::rax), .src = Operand::i(value)}, out);
+    size += X86Encoder::encode({.op = Op::ret}, out + size);
+    return size;
+}
+
+// machine code for the program as `int64_t f()`, the way --run calls it: put into executable memory and called, it
+// returns the value the program passes to exit. every Clear program is a constant, so it is folded to that value here
+template <Source src>
+[[nodiscard]] consteval auto compile() {
+    constexpr int64_t value = evaluate(src.view());
+    constexpr size_t size = [value] {
+        uint8_t scratch[2 * X86Encoder::max_instr_size] {};
+        return encode_return(value, scratch);
+    }();
+    std::array<uint8_t, size> code {};
+    encode_return(value, code.data());
+    return code;
+}
+
+} // namespace clear
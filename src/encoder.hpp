@@ -0,0 +1,310 @@
+// Contains the x86-64 machine code encoder for the instructions the generator emits
+#pragma once
+
+#include <iostream>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "x86.hpp"
+
+// encodes one instruction at a time into a small fixed buffer
+// only the operand combinations the generators actually produce are supported, anything else is a compiler bug
+class X86Encoder {
+public:
+    static constexpr size_t max_instr_size = 15;
+
+    // encodes `instr` into `out` (at least max_instr_size bytes) and returns the number of bytes written
+    // constexpr, so the compile time front end (embed.hpp) can encode as well
+    static constexpr size_t encode(const Instr& instr, uint8_t* out) {
+        X86Encoder enc(out);
+        switch (instr.op) {
+            case Op::mov:
+                enc.encode_mov(instr);
+                break;
+            case Op::lea:
+                enc.encode_lea(instr);
+                break;
+            case Op::push:
+                enc.encode_push_pop(instr.dst, 0x50, 0xFF, 6);
+                break;
+            case Op::pop:
+                enc.encode_push_pop(instr.dst, 0x58, 0x8F, 0);
+                break;
+            case Op::add:
+                enc.encode_alu(instr, 0x00, 0);
+                break;
+            case Op::sub:
+                enc.encode_alu(instr, 0x28, 5);
+                break;
+            case Op::imul:
+                enc.encode_imul(instr);
+                break;
+            case Op::imul_wide:
+                enc.encode_unary(instr, 5);
+                break;
+            case Op::neg:
+                enc.encode_unary(instr, 3);
+                break;
+            case Op::shl:
+                enc.encode_shift(instr, 4);
+                break;
+            case Op::shr:
+                enc.encode_shift(instr, 5);
+                break;
+            case Op::sar:
+                enc.encode_shift(instr, 7);
+                break;
+            case Op::cqo:
+                enc.byte(0x48);
+                enc.byte(0x99);
+                break;
+            case Op::idiv:
+                enc.encode_unary(instr, 7);
+                break;
+            case Op::syscall:
+                enc.byte(0x0F);
+                enc.byte(0x05);
+                break;
+            case Op::ret:
+                enc.byte(0xC3);
+                break;
+        }
+        return enc.m_size;
+    }
+
+    // appends the encoding of every instruction in `code` to `out`
+    static void encode(std::span<const Instr> code, std::string& out) {
+        size_t size = out.size();
+        out.resize(size + code.size() * max_instr_size);
+        for (const Instr& instr : code) {
+            size += encode(instr, reinterpret_cast<uint8_t*>(out.data() + size));
+        }
+        out.resize(size);
+    }
+
+private:
+    constexpr explicit X86Encoder(uint8_t* out)
+        : m_out(out)
+    {
+    }
+
+    [[noreturn]] static void unsupported(const Instr& instr) {
+        std::cerr << "Cannot encode `" << op_name(instr.op) << "` with these operands" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    constexpr void byte(uint8_t b) {
+        m_out[m_size++] = b;
+    }
+    constexpr void imm32(int32_t value) {
+        imm(static_cast<uint64_t>(static_cast<uint32_t>(value)), 4);
+    }
+    constexpr void imm64(int64_t value) {
+        imm(static_cast<uint64_t>(value), 8);
+    }
+    // little endian
+    constexpr void imm(uint64_t value, size_t size) {
+        if (std::is_constant_evaluated()) {
+            for (size_t i = 0; i < size; i++) {
+                byte(static_cast<uint8_t>(value >> (8 * i)));
+            }
+            return;
+        }
+        memcpy(m_out + m_size, &value, size);
+        m_size += size;
+    }
+
+    static constexpr uint8_t enc(Reg reg) {
+        return static_cast<uint8_t>(reg);
+    }
+
+    // REX prefix, skipped when none of its bits are needed
+    constexpr void rex(bool w, uint8_t reg, uint8_t base, uint8_t index = 0) {
+        const uint8_t prefix = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    // REX prefix for `reg_field` and a register or memory r/m operand
+    constexpr void rex(bool w, uint8_t reg_field, const Operand& rm) {
+        rex(w, reg_field, enc(rm.reg), rm.has_index() ? enc(rm.index) : 0);
+    }
+
+    // ModRM (+ SIB + displacement) for `reg_field` and a register or memory r/m operand
+    constexpr void modrm(uint8_t reg_field, const Operand& rm) {
+        const uint8_t reg_bits = (reg_field & 7) << 3;
+        const uint8_t base = enc(rm.reg) & 7;
+        if (rm.is_reg()) {
+            byte(0xC0 | reg_bits | base);
+            return;
+        }
+        // rbp/r13 as a base always need a displacement, rsp/r12 as a base or any index need a SIB byte
+        const bool disp8 = rm.disp >= INT8_MIN && rm.disp <= INT8_MAX;
+        uint8_t mod;
+        if (rm.disp == 0 && base != 5) {
+            mod = 0x00;
+        } else if (disp8) {
+            mod = 0x40;
+        } else {
+            mod = 0x80;
+        }
+        if (rm.has_index()) {
+            const uint8_t scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            byte(mod | reg_bits | 4);
+            byte(static_cast<uint8_t>(scale_bits << 6 | (enc(rm.index) & 7) << 3 | base));
+        } else {
+            byte(mod | reg_bits | base);
+            if (base == 4) {
+                byte(0x24);
+            }
+        }
+        if (mod == 0x40) {
+            byte(static_cast<uint8_t>(static_cast<int8_t>(rm.disp)));
+        } else if (mod == 0x80) {
+            imm32(rm.disp);
+        }
+    }
+
+    // opcode with a register / memory r/m operand and either a register or an opcode extension in the reg field
+    constexpr void op_rm(bool w, uint8_t opcode, uint8_t reg_field, const Operand& rm) {
+        rex(w, reg_field, rm);
+        byte(opcode);
+        modrm(reg_field, rm);
+    }
+
+    constexpr void encode_mov(const Instr& instr) {
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        if (src.is_reg() && (dst.is_reg() || dst.is_mem())) {
+            op_rm(true, 0x89, enc(src.reg), dst);
+        } else if (dst.is_reg() && src.is_mem()) {
+            op_rm(true, 0x8B, enc(dst.reg), src);
+        } else if (dst.is_reg() && src.is_imm()) {
+            // pick the shortest form: zero extending mov r32, sign extended imm32, then the full imm64
+            const uint8_t reg = enc(dst.reg);
+            if (src.imm >= 0 && src.imm <= UINT32_MAX) {
+                rex(false, 0, reg);
+                byte(0xB8 + (reg & 7));
+                imm32(static_cast<int32_t>(static_cast<uint32_t>(src.imm)));
+            } else if (fits_imm32(src.imm)) {
+                op_rm(true, 0xC7, 0, dst);
+                imm32(static_cast<int32_t>(src.imm));
+            } else {
+                rex(true, 0, reg);
+                byte(0xB8 + (reg & 7));
+                imm64(src.imm);
+            }
+        } else if (dst.is_mem() && src.is_imm() && fits_imm32(src.imm)) {
+            op_rm(true, 0xC7, 0, dst);
+            imm32(static_cast<int32_t>(src.imm));
+        } else {
+            unsupported(instr);
+        }
+    }
+
+    constexpr void encode_push_pop(const Operand& operand, uint8_t short_opcode, uint8_t rm_opcode, uint8_t ext) {
+        if (operand.is_reg()) {
+            const uint8_t reg = enc(operand.reg);
+            rex(false, 0, reg);
+            byte(short_opcode + (reg & 7));
+        } else if (operand.is_mem()) {
+            op_rm(false, rm_opcode, ext, operand); // push / pop default to 64 bit operands
+        } else if (operand.is_imm() && short_opcode == 0x50 && fits_imm32(operand.imm)) {
+            if (operand.imm >= INT8_MIN && operand.imm <= INT8_MAX) {
+                byte(0x6A);
+                byte(static_cast<uint8_t>(static_cast<int8_t>(operand.imm)));
+            } else {
+                byte(0x68);
+                imm32(static_cast<int32_t>(operand.imm));
+            }
+        } else {
+            unsupported({.op = short_opcode == 0x50 ? Op::push : Op::pop, .dst = operand});
+        }
+    }
+
+    // the classic two operand arithmetic group (add, or, and, sub, xor, cmp) shares one encoding scheme:
+    // `base` + 1 for r/m, reg, `base` + 3 for reg, r/m and 0x81 / 0x83 with an opcode extension for immediates
+    constexpr void encode_alu(const Instr& instr, uint8_t base, uint8_t ext) {
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        if (src.is_reg() && (dst.is_reg() || dst.is_mem())) {
+            op_rm(true, base + 1, enc(src.reg), dst);
+        } else if (dst.is_reg() && src.is_mem()) {
+            op_rm(true, base + 3, enc(dst.reg), src);
+        } else if ((dst.is_reg() || dst.is_mem()) && src.is_imm() && fits_imm32(src.imm)) {
+            if (src.imm >= INT8_MIN && src.imm <= INT8_MAX) {
+                op_rm(true, 0x83, ext, dst);
+                byte(static_cast<uint8_t>(static_cast<int8_t>(src.imm)));
+            } else {
+                op_rm(true, 0x81, ext, dst);
+                imm32(static_cast<int32_t>(src.imm));
+            }
+        } else {
+            unsupported(instr);
+        }
+    }
+
+    // lea r64, [mem]
+    constexpr void encode_lea(const Instr& instr) {
+        if (!instr.dst.is_reg() || !instr.src.is_mem()) {
+            unsupported(instr);
+        }
+        op_rm(true, 0x8D, enc(instr.dst.reg), instr.src);
+    }
+
+    // imul reg, r/m is 0F AF, imul reg, imm is the three operand 6B / 69 form with the register as both sources
+    constexpr void encode_imul(const Instr& instr) {
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        if (!dst.is_reg()) {
+            unsupported(instr);
+        }
+        if (src.is_reg() || src.is_mem()) {
+            rex(true, enc(dst.reg), src);
+            byte(0x0F);
+            byte(0xAF);
+            modrm(enc(dst.reg), src);
+        } else if (src.is_imm() && fits_imm32(src.imm)) {
+            if (src.imm >= INT8_MIN && src.imm <= INT8_MAX) {
+                op_rm(true, 0x6B, enc(dst.reg), dst);
+                byte(static_cast<uint8_t>(static_cast<int8_t>(src.imm)));
+            } else {
+                op_rm(true, 0x69, enc(dst.reg), dst);
+                imm32(static_cast<int32_t>(src.imm));
+            }
+        } else {
+            unsupported(instr);
+        }
+    }
+
+    // the F7 group: one register / memory operand, the operation is picked by the opcode extension
+    constexpr void encode_unary(const Instr& instr, uint8_t ext) {
+        if (!instr.dst.is_reg() && !instr.dst.is_mem()) {
+            unsupported(instr);
+        }
+        op_rm(true, 0xF7, ext, instr.dst);
+    }
+
+    // shifts by an immediate count, D1 is the short form for shifting by one
+    constexpr void encode_shift(const Instr& instr, uint8_t ext) {
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        if ((!dst.is_reg() && !dst.is_mem()) || !src.is_imm() || src.imm < 0 || src.imm > 63) {
+            unsupported(instr);
+        }
+        if (src.imm == 1) {
+            op_rm(true, 0xD1, ext, dst);
+        } else {
+            op_rm(true, 0xC1, ext, dst);
+            byte(static_cast<uint8_t>(src.imm));
+        }
+    }
+
+    // member vars
+    uint8_t* m_out;
+    size_t m_size = 0;
+};
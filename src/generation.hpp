@@ -1,145 +1,505 @@
 #pragma once
 
-#include <sstream>
-#include <unordered_map>
+#include <algorithm>
+#include <bit>
+#include <string>
+#include <utility>
+#include <span>
+#include <string_view>
+#include <variant>
+#include <vector>
 
 #include "parser.hpp"
+#include "resolve.hpp"
+#include "ir.hpp"
+#include "passes.hpp"
+#include "regalloc.hpp"
+#include "peephole.hpp"
+#include "strength.hpp"
+#include "x86.hpp"
+#include "asm_writer.hpp"
+#include "elf.hpp"
+#include "jit.hpp"
+#include "stack_gen.hpp"
+#include "thread_pool.hpp"
+#include "code_stats.hpp"
 #include <cassert>
 
+// where the generated instructions go: nasm text (-S), an executable encoded in process, JIT memory (--run) or only
+// counted (the codegen benchmark)
+using CodeSink = std::variant<AsmWriter*, ElfWriter*, JitBuffer*, CodeStats*>;
+
 class Generator {
 public:
-    inline explicit Generator(NodeProgram root) 
-        : m_prog(std::move(root))
+    // instructions are handed to `sink` in chunks as they are generated
+    // the names in `root` must have been resolved (resolve_names), variables are looked up by symbol id unchecked
+    // code for the JIT is called as a function, so exit returns its value instead of issuing the exit syscall
+    // every chunk goes through `peephole` before it reaches the sink, at every optimization level
+    inline explicit Generator(NodeProgram root, CodeSink sink, OptLevel opt_level = OptLevel::O0, Peephole peephole = {})
+        : m_prog(std::move(root)),
+        m_sink(sink),
+        m_returns(std::holds_alternative<JitBuffer*>(sink)),
+        m_opt_level(opt_level),
+        m_pass_manager(opt_level),
+        m_peephole(std::move(peephole))
     {
     }
 
-    void gen_term(const NodeTerm* term) {
-        struct TermVisistor {
-            Generator* gen;
-            void operator()(const NodeTermIntLit* term_int_lit) const {
-                gen->m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen->push("rax");
+    // generates the entire program (root) into the sink
+    // at -O0 pieces of the program are generated on `pool` if there is one, see gen_stack_machine
+    void generate_prog(ThreadPool* pool = nullptr) {
+        if (m_opt_level == OptLevel::O0) {
+            gen_stack_machine(pool);
+        } else {
+            IrLowering lowering(m_prog);
+            IrProgram ir = lowering.lower_prog();
+            m_var_count = lowering.var_count();
+            m_pass_manager.run(ir);
+            gen_ir(ir, LinearScan(ir).run());
+
+            // once dead code elimination has run the program ends in its first exit, nothing follows it
+            if (ir.instrs.empty() || ir.instrs.back().op != IrOp::exit) {
+                gen_default_exit();
             }
-            void operator()(const NodeTermIdent* term_ident) const {
-                const auto& ident_value = term_ident->ident.value.value();
-                
-                if (!gen->m_vars.contains(ident_value)) {
-                    std::cerr << "Variable '" << ident_value << "' not declared" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+        }
 
-                const auto& var = gen->m_vars.at(ident_value);
+        flush_code(true);
+        std::visit([](auto* sink) { sink->finish(); }, m_sink);
+    }
 
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen->m_stack_size - var.stack_loc - 1) * 8 << "]";
-                gen->push(offset.str());
-            }
-        };
-        TermVisistor visitor({.gen = this});
-        std::visit(visitor, term->var);
+    [[nodiscard]] inline const PassManager& pass_manager() const {
+        return m_pass_manager;
+    }
+
+    [[nodiscard]] inline const Peephole& peephole() const {
+        return m_peephole;
+    }
+
+    // number of variables the program declared
+    [[nodiscard]] inline size_t var_count() const {
+        return m_var_count;
+    }
+
+    // deepest the stack got, in 8 byte slots: the frame and the deepest expression at -O0, the spill slots of the
+    // frame otherwise
+    [[nodiscard]] inline size_t peak_stack_size() const {
+        return m_peak_stack_size;
     }
 
-    // **NOTE
-    // a 'visitor' is a design pattern that maps input to functionality based on the input's type
-    // example: if an expr with an int lit node gets passed in, the associated int lit functionality gets ran
+    // generates the -O0 stack machine code in pieces of whole statements (StackLayout::pieces). every piece is
+    // generated, run through its own copy of the peephole optimizer and encoded for the sink on its own, on `pool`
+    // if there is one, then the pieces are handed to the sink in order
+    // the pieces only depend on the program, so the output is the same for any number of threads. the peephole
+    // optimizer cannot combine instructions across the end of a piece, at the size of a piece that costs nothing
+    // the prologue reserves the frame for the variables (StackLayout), the stack is empty wherever a piece starts
+    void gen_stack_machine(ThreadPool* pool) {
+        const StackLayout layout = StackLayout::of(m_prog, stack_piece_nodes);
+        m_var_count = layout.var_count;
+        // the first piece starts with the prologue, the last one ends with the default exit
+        // rbx holds an operand of every binary operator
+        gen_prologue(1u << static_cast<int>(Reg::rbx), static_cast<uint32_t>(layout.frame_slots));
+        const std::vector<Instr> prologue = std::exchange(m_code, {});
+        gen_default_exit();
+        const std::vector<Instr> epilogue = std::exchange(m_code, {});
 
-    // handle generation of assembly for expressions
-    void gen_expr(const NodeExpr* expr) {
-        // declare the visitor for expressions
-        struct ExprVisitor {
-            Generator* gen;
+        std::visit([&](auto* sink) {
+            using Sink = std::remove_pointer_t<decltype(sink)>;
+            // a sink that can encode on other threads takes the pieces as bytes, the others as instructions
+            constexpr bool encodes = requires(std::string& out) { Sink::encode(std::span<const Instr>(), out); };
+
+            // a couple of pieces per thread are in flight at a time, so memory does not grow with the program
+            const size_t slots = std::min(pool != nullptr ? pool->thread_count() * 2 : 1, layout.pieces.size());
+            std::vector<std::vector<Instr>> code(slots);
+            std::vector<std::string> bytes(slots);
+            std::vector<Peephole> peepholes(slots, m_peephole);
+            for (Peephole& peephole : peepholes) {
+                peephole.clear_counts();
+            }
+            std::vector<size_t> peaks(slots, 0);
+
+            for (size_t first = 0; first < layout.pieces.size(); first += slots) {
+                const size_t count = std::min(slots, layout.pieces.size() - first);
+                const auto gen_piece = [&](size_t slot) {
+                    const size_t index = first + slot;
+                    const bool last = index + 1 == layout.pieces.size();
+                    const StackPiece& piece = layout.pieces[index];
+                    code[slot].clear();
+                    if (index == 0) {
+                        code[slot].assign(prologue.begin(), prologue.end());
+                    }
+                    StackGen gen(m_prog, layout, m_saved_regs, m_returns, 0);
+                    gen.gen_nodes(piece.first_node, piece.end_node, code[slot]);
+                    if (last) {
+                        code[slot].insert(code[slot].end(), epilogue.begin(), epilogue.end());
+                    }
+                    peepholes[slot].run(code[slot], last);
+                    peaks[slot] = std::max(peaks[slot], gen.peak_stack_size());
+                    if constexpr (encodes) {
+                        bytes[slot].clear();
+                        Sink::encode(code[slot], bytes[slot]);
+                    }
+                };
+                if (pool != nullptr) {
+                    pool->parallel_for(count, gen_piece);
+                } else {
+                    for (size_t slot = 0; slot < count; slot++) {
+                        gen_piece(slot);
+                    }
+                }
+
+                if constexpr (encodes) {
+                    sink->write_encoded(std::span<const std::string>(bytes.data(), count));
+                } else {
+                    for (size_t slot = 0; slot < count; slot++) {
+                        sink->write(code[slot]);
+                    }
+                }
+            }
 
-            // handle terms (int lit, ident...)
-            void operator()(const NodeTerm* term) const {
-                gen->gen_term(term);
+            for (size_t slot = 0; slot < slots; slot++) {
+                m_peephole.add_counts(peepholes[slot]);
+                m_peak_stack_size = std::max(m_peak_stack_size, layout.frame_slots + peaks[slot]);
             }
-            // handles binary expressions
-            void operator()(const NodeBinExpr* bin_expr) const {
-                // gen both sides of the bin expr and leave them on the top of the stack
-                gen->gen_expr(bin_expr->add->lhs);
-                gen->gen_expr(bin_expr->add->rhs);
-
-                // retreive the values from the stack to perform addition
-                gen->pop("rax");
-                gen->pop("rbx");
-
-                // stream addition command into asm output
-                gen->m_output << "    add rax, rbx\n"; // add command adds the values in the 2 registers and stores the result in the first register listed (rax)
-                // push the evaluated value back onto the stack so it can be assigned to an identifier
-                gen->push("rax");
+        }, m_sink);
+    }
+
+    // generates the -O0 stack machine code for a program streamed from `parser` one statement at a time
+    // (Parser::next_stmt), without the program ever existing as a whole: every statement is checked, generated and
+    // forgotten before the next one is parsed
+    // the live ranges of the variables are not known before the program ends, so they cannot share frame slots:
+    // they stay on the stack where their lets leave them (StackLayout::add_var) and no frame is reserved
+    // the code of a piece is held until the piece is complete, the statements are cut into the same pieces as
+    // gen_stack_machine's and each piece is optimized in one go. memory is bounded by the size of a piece (or of the
+    // largest statement)
+    void generate_stream(Parser& parser) {
+        StackLayout layout;
+        NameResolver resolver;
+        gen_prologue(1u << static_cast<int>(Reg::rbx), 0);
+        size_t piece_nodes = 0;
+        while (const NodeProgram* stmt = parser.next_stmt()) {
+            // a full piece is only ended once another statement follows it, the last one ends with the default exit
+            if (piece_nodes >= stack_piece_nodes) {
+                flush_code(false, true);
+                piece_nodes = 0;
             }
-        };
-
-        ExprVisitor visitor({.gen = this});
-        std::visit(visitor, expr->var);
-    }
-
-    // handle generation of assembly for statements
-    void gen_stmt(const NodeStmt* stmt) {
-        // define visitor for stmts
-        struct StmtVisitor {
-            Generator* gen;
-            // handle exit stmt
-            void operator()(const NodeStmtExit* stmt_exit) const {
-                gen->gen_expr(stmt_exit->expr);
-                gen->m_output << "    mov rax, 60\n";
-                gen->pop("rdi");
-                gen->m_output << "    syscall\n";
+            resolver.resolve(*stmt);
+            StackGen gen(*stmt, layout, m_saved_regs, m_returns, layout.var_count);
+            gen.gen_nodes(0, static_cast<uint32_t>(stmt->node_count()), m_code);
+            m_peak_stack_size = std::max(m_peak_stack_size, gen.peak_stack_size());
+            const uint32_t root = stmt->stmts.front();
+            if (stmt->kinds[root] == NodeKind::stmt_let) {
+                layout.add_var(stmt->rhs[root]);
             }
-            //handle let stmt
-            void operator()(const NodeStmtLet* stmt_let) {
-                if (gen->m_vars.contains(stmt_let->ident.value.value())) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+            piece_nodes += stmt->node_count();
+        }
+        m_var_count = layout.var_count;
+        gen_default_exit();
+
+        flush_code(true);
+        std::visit([](auto* sink) { sink->finish(); }, m_sink);
+    }
+
+    // generates code for an IR program whose vregs have been assigned registers / frame slots
+    void gen_ir(const IrProgram& ir, const Allocation& alloc) {
+        gen_prologue(alloc.used_regs, alloc.frame_slots);
+        m_peak_stack_size = alloc.frame_slots;
+
+        for (const IrInstr& instr : ir.instrs) {
+            switch (instr.op) {
+                case IrOp::imm: {
+                    const Location& dst = alloc.locations[instr.dst];
+                    if (dst.is_imm()) {
+                        break; // rematerialized at every use
+                    }
+                    gen_imm(dst, instr.imm);
+                    break;
+                }
+                case IrOp::copy:
+                    gen_mov(alloc.locations[instr.dst], alloc.locations[instr.lhs]);
+                    break;
+                case IrOp::add:
+                    gen_bin(Op::add, alloc.locations[instr.dst], alloc.locations[instr.lhs], alloc.locations[instr.rhs], true);
+                    break;
+                case IrOp::sub:
+                    gen_bin(Op::sub, alloc.locations[instr.dst], alloc.locations[instr.lhs], alloc.locations[instr.rhs], false);
+                    break;
+                case IrOp::mul: {
+                    const Location& dst = alloc.locations[instr.dst];
+                    const Location& lhs = alloc.locations[instr.lhs];
+                    const Location& rhs = alloc.locations[instr.rhs];
+                    if (rhs.is_imm() && gen_mul_const(dst, lhs, rhs.imm)) {
+                        break;
+                    }
+                    if (lhs.is_imm() && gen_mul_const(dst, rhs, lhs.imm)) {
+                        break;
+                    }
+                    gen_bin(Op::imul, dst, lhs, rhs, true);
+                    break;
                 }
+                case IrOp::div:
+                    // the allocator keeps rdx free across divisions and leaves only constant divisors other than 0
+                    // and -1 as immediates
+                    if (alloc.locations[instr.rhs].is_imm()) {
+                        gen_div_const(alloc.locations[instr.dst], alloc.locations[instr.lhs], alloc.locations[instr.rhs].imm);
+                        break;
+                    }
+                    gen_mov(scratch, alloc.locations[instr.lhs]);
+                    emit(Op::cqo);
+                    emit(Op::idiv, operand(alloc.locations[instr.rhs]));
+                    gen_mov(alloc.locations[instr.dst], scratch);
+                    break;
+                case IrOp::exit:
+                    if (m_returns) {
+                        gen_mov(Location::in_reg(Reg::rax), alloc.locations[instr.lhs]);
+                        gen_return();
+                        break;
+                    }
+                    gen_mov(Location::in_reg(Reg::rdi), alloc.locations[instr.lhs]);
+                    emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+                    emit(Op::syscall);
+                    break;
+            }
+            if (m_code.size() >= flush_threshold) {
+                flush_code();
+            }
+        }
+    }
+
+private:
+    // instructions are buffered and handed to the sink in chunks of roughly this size
+    static constexpr size_t flush_threshold = 4096;
+
+    // -O0 code is generated in pieces of whole statements of at least this many nodes
+    static constexpr size_t stack_piece_nodes = 1 << 14;
+
+    // rax is never handed out by the allocator and is free for shuffling memory operands
+    static constexpr Location scratch = Location::in_reg(Reg::rax);
+
+    void emit(Op op, Operand dst = {}, Operand src = {}) {
+        m_code.push_back({.op = op, .dst = dst, .src = src});
+    }
+
+    // runs the peephole optimizer over the buffer and hands it to the sink
+    // unless this is the end of the program the last few instructions are held back, more code follows them that
+    // they may still combine with. at the end of a piece of -O0 code (`piece_end`) nothing is held back either, the
+    // optimizer does not combine across pieces
+    void flush_code(bool last = false, bool piece_end = false) {
+        m_peephole.run(m_code, last);
+        const bool hold_back = !last && !piece_end && m_peephole.enabled();
+        const size_t keep = hold_back ? std::min(m_code.size(), Peephole::lookahead) : 0;
+        const std::span<const Instr> ready(m_code.data(), m_code.size() - keep);
+        std::visit([ready](auto* sink) { sink->write(ready); }, m_sink);
+        m_code.erase(m_code.begin(), m_code.end() - static_cast<std::ptrdiff_t>(keep));
+    }
 
-                gen->m_vars.insert({stmt_let->ident.value.value(), Var {.stack_loc = gen->m_stack_size}});
-                gen->gen_expr(stmt_let->expr);
+    // sets up the frame
+    // spilled vregs live in fixed slots below rbp, they are all reserved up front
+    // when the code is called as a function the callee-saved registers in `used_regs` are preserved as well
+    void gen_prologue(uint32_t used_regs, uint32_t frame_slots) {
+        if (m_returns) {
+            for (int reg = 0; reg < reg_count; reg++) {
+                if ((used_regs >> reg & 1) != 0 && is_callee_saved(static_cast<Reg>(reg))) {
+                    emit(Op::push, Operand::r(static_cast<Reg>(reg)));
+                    m_saved_regs.push_back(static_cast<Reg>(reg));
+                }
             }
-        };
+        }
+        if (m_returns || frame_slots > 0) {
+            emit(Op::push, Operand::r(Reg::rbp));
+            emit(Op::mov, Operand::r(Reg::rbp), Operand::r(Reg::rsp));
+        }
+        if (frame_slots > 0) {
+            emit(Op::sub, Operand::r(Reg::rsp), Operand::i(static_cast<int64_t>(frame_slots) * 8));
+        }
+    }
 
-        StmtVisitor visitor({.gen = this});
-        std::visit(visitor, stmt->var);
+    // returns the value in rax to the caller, undoing gen_prologue
+    // rsp is reset from rbp, so whatever the stack machine left on the stack is dropped
+    void gen_return() {
+        emit_return(m_code, m_saved_regs);
     }
 
-    // generates assembly for the entire program (root)
-    [[nodiscard]] std::string generate_prog() {
-        m_output << "global _start\n_start:\n"; // starter assembly. independant of other circumstances
+    // exits with status 0 if the program did not exit on its own
+    void gen_default_exit() {
+        if (m_returns) {
+            emit(Op::mov, Operand::r(Reg::rax), Operand::i(0));
+            gen_return();
+            return;
+        }
+        emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+        emit(Op::mov, Operand::r(Reg::rdi), Operand::i(0));
+        emit(Op::syscall);
+    }
 
-        // generate the assembly for each stmt in the program
-        for (const NodeStmt* stmt : m_prog.stmts) {
-            gen_stmt(stmt);
+    // the instruction operand for a register, frame slot or immediate location
+    static Operand operand(const Location& loc) {
+        switch (loc.kind) {
+            case Location::Kind::reg:
+                return Operand::r(loc.reg);
+            case Location::Kind::slot:
+                return Operand::m(Reg::rbp, -static_cast<int32_t>((loc.slot + 1) * 8));
+            default:
+                return Operand::i(loc.imm);
         }
+    }
 
-        // default exit if nothing is specified
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
+    // moves between two locations, skipping moves to self and splitting memory to memory moves
+    void gen_mov(const Location& dst, const Location& src) {
+        if (dst == src) {
+            return;
+        }
+        if (dst.is_mem() && src.is_mem()) {
+            gen_mov(scratch, src);
+            gen_mov(dst, scratch);
+            return;
+        }
+        emit(Op::mov, operand(dst), operand(src));
+    }
 
-        // return entire assembly file as a string
-        return m_output.str();
+    // loads a constant into a register or frame slot
+    void gen_imm(const Location& dst, int64_t value) {
+        // a memory destination only takes a sign extended 32 bit immediate
+        if (dst.is_mem() && !fits_imm32(value)) {
+            emit(Op::mov, operand(scratch), Operand::i(value));
+            gen_mov(dst, scratch);
+        } else {
+            emit(Op::mov, operand(dst), Operand::i(value));
+        }
     }
-    
-private:
-    // pushes a value from a given register and incriments stack size
-    void push(const std::string& reg) {
-        m_output << "    push " << reg << "\n";
-        m_stack_size++;
+
+    // dst = src * c with shifts, lea, add and sub (see plan_mul) where that beats imul's 3 cycle latency
+    // returns false without emitting anything if there is no such sequence
+    bool gen_mul_const(const Location& dst, const Location& src, int64_t c) {
+        if (src.is_imm()) {
+            gen_imm(dst, ir_eval(IrOp::mul, src.imm, c).value());
+            return true;
+        }
+        const MulPlan plan = plan_mul(c);
+        // the sequence runs in dst if that is a register, otherwise in the scratch register
+        const Location work = dst.is_reg() ? dst : scratch;
+        const bool rereads_src = plan.kind == MulPlan::Kind::shift_add || plan.kind == MulPlan::Kind::shift_sub;
+        if (plan.kind == MulPlan::Kind::none || (rereads_src && src == work)) {
+            return false;
+        }
+        switch (plan.kind) {
+            case MulPlan::Kind::none:
+                break;
+            case MulPlan::Kind::zero:
+                gen_imm(dst, 0);
+                return true;
+            case MulPlan::Kind::copy:
+                gen_mov(work, src);
+                break;
+            case MulPlan::Kind::shift:
+                gen_mov(work, src);
+                emit(Op::shl, operand(work), Operand::i(plan.shift));
+                break;
+            case MulPlan::Kind::lea:
+            case MulPlan::Kind::lea_lea: {
+                // lea takes registers only, a value in memory is loaded first
+                const Reg x = src.is_reg() ? src.reg : work.reg;
+                gen_mov(work, src.is_reg() ? work : src);
+                emit(Op::lea, operand(work), Operand::m(x, x, plan.scale1, 0));
+                if (plan.kind == MulPlan::Kind::lea_lea) {
+                    emit(Op::lea, operand(work), Operand::m(work.reg, work.reg, plan.scale2, 0));
+                }
+                if (plan.shift > 0) {
+                    emit(Op::shl, operand(work), Operand::i(plan.shift));
+                }
+                break;
+            }
+            case MulPlan::Kind::shift_add:
+            case MulPlan::Kind::shift_sub:
+                gen_mov(work, src);
+                emit(Op::shl, operand(work), Operand::i(plan.shift));
+                emit(plan.kind == MulPlan::Kind::shift_add ? Op::add : Op::sub, operand(work), operand(src));
+                break;
+        }
+        if (plan.negate) {
+            emit(Op::neg, operand(work));
+        }
+        gen_mov(dst, work);
+        return true;
     }
-    // pops a value from a given register and decrements stack size
-    void pop(const std::string& reg) {
-        m_output << "    pop " << reg << "\n";
-        m_stack_size--;
+
+    // dst = src / d for a constant d other than 0 and -1, truncating like idiv but without its 40 to 90 cycles
+    // (INT64_MIN / -1 has to trap like idiv does, a -1 divisor is left to idiv by the allocator)
+    // powers of two are an arithmetic shift after biasing negative dividends by 2^k - 1, everything else is a
+    // multiplication by the reciprocal from div_magic. rax and rdx are free at a division
+    void gen_div_const(const Location& dst, const Location& src, int64_t d) {
+        if (src.is_imm()) {
+            gen_imm(dst, ir_eval(IrOp::div, src.imm, d).value());
+            return;
+        }
+        if (d == 1) {
+            gen_mov(dst, src);
+            return;
+        }
+        const Location rdx = Location::in_reg(Reg::rdx);
+
+        const uint64_t magnitude = d < 0 ? 0 - static_cast<uint64_t>(d) : static_cast<uint64_t>(d);
+        if (std::has_single_bit(magnitude)) {
+            const int k = std::countr_zero(magnitude);
+            gen_mov(scratch, src);
+            emit(Op::mov, operand(rdx), operand(scratch));
+            if (k > 1) {
+                emit(Op::sar, operand(rdx), Operand::i(63));
+            }
+            emit(Op::shr, operand(rdx), Operand::i(64 - k));
+            emit(Op::add, operand(scratch), operand(rdx));
+            emit(Op::sar, operand(scratch), Operand::i(k));
+            if (d < 0) {
+                emit(Op::neg, operand(scratch));
+            }
+            gen_mov(dst, scratch);
+            return;
+        }
+
+        const DivMagic magic = div_magic(d);
+        emit(Op::mov, operand(scratch), Operand::i(magic.multiplier));
+        emit(Op::imul_wide, operand(src));
+        if (d > 0 && magic.multiplier < 0) {
+            emit(Op::add, operand(rdx), operand(src));
+        } else if (d < 0 && magic.multiplier > 0) {
+            emit(Op::sub, operand(rdx), operand(src));
+        }
+        if (magic.shift > 0) {
+            emit(Op::sar, operand(rdx), Operand::i(magic.shift));
+        }
+        // the shifted product rounds toward minus infinity, adding its sign bit rounds toward zero instead
+        emit(Op::mov, operand(scratch), operand(rdx));
+        emit(Op::shr, operand(scratch), Operand::i(63));
+        emit(Op::add, operand(rdx), operand(scratch));
+        gen_mov(dst, rdx);
     }
 
-    // variable struct, contains information about a variable stored in the stack
-    struct Var {
-        size_t stack_loc;
-    };
+    // dst = lhs `op` rhs for a two operand instruction that writes its first operand
+    void gen_bin(Op op, const Location& dst, const Location& lhs, const Location& rhs, bool commutes) {
+        if (dst.is_mem() || (dst == rhs && !(dst == lhs) && !commutes)) {
+            // x86 allows at most one memory operand (and imul only writes registers), and a non commutative op
+            // cannot overwrite its rhs before using it, go through the scratch register
+            gen_mov(scratch, lhs);
+            emit(op, operand(scratch), operand(rhs));
+            gen_mov(dst, scratch);
+        } else if (dst == lhs) {
+            emit(op, operand(dst), operand(rhs));
+        } else if (dst == rhs) {
+            emit(op, operand(dst), operand(lhs)); // the op commutes
+        } else {
+            gen_mov(dst, lhs);
+            emit(op, operand(dst), operand(rhs));
+        }
+    }
 
     // member vars
     const NodeProgram m_prog;
-    std::stringstream m_output;
-    size_t m_stack_size = 0;
-    std::unordered_map<std::string, Var> m_vars {};
-};
\ No newline at end of file
+    CodeSink m_sink;
+    const bool m_returns; // exit returns to the caller instead of ending the process
+    std::vector<Reg> m_saved_regs; // callee-saved registers pushed by the prologue, in push order
+    const OptLevel m_opt_level;
+    PassManager m_pass_manager;
+    Peephole m_peephole;
+    std::vector<Instr> m_code; // generated instructions not yet handed to the sink
+    size_t m_peak_stack_size = 0;
+    size_t m_var_count = 0;
+};
@@ -0,0 +1,146 @@
+// Contains the bytecode interpreter behind --interp: programs run without generating any machine code, which makes it
+// a quick way to evaluate a program and a reference to test the native backends against
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <csignal>
+
+#include "parser.hpp"
+
+// register machine instructions, every operand is an index into the register file
+enum class BcOp : uint32_t {
+    mov, // dst = lhs
+    add, // dst = lhs + rhs
+    sub, // dst = lhs - rhs
+    mul, // dst = lhs * rhs
+    div, // dst = lhs / rhs
+    exit, // stops with the value of lhs
+    halt, // stops with 0, the end of a program that never exits
+};
+
+struct BcInstr {
+    BcOp op;
+    uint32_t dst;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+// the register file holds every variable at its symbol id, then one register per integer literal, then the
+// temporaries of the deepest expression. variables and literals are resolved to their registers when compiling, so
+// no instruction ever looks anything up or loads a constant
+struct Bytecode {
+    std::vector<BcInstr> code;
+    std::vector<int64_t> registers; // initial values: variables 0, literals their value, temporaries 0
+
+    [[nodiscard]] inline size_t bytes() const {
+        return code.size() * sizeof(BcInstr) + registers.size() * sizeof(int64_t);
+    }
+};
+
+// compiles a program whose names have been resolved (resolve_names)
+// the nodes are in postorder, so an operand stack of registers rebuilds every expression: a binary operator pops its
+// two operands and pushes the temporary at the stack depth it leaves, which neither operand still needs
+[[nodiscard]] inline Bytecode compile_bytecode(const NodeProgram& prog) {
+    const auto literal_base = static_cast<uint32_t>(prog.symbols.size());
+    const auto temp_base = static_cast<uint32_t>(literal_base + prog.int_lits.size());
+    Bytecode bc;
+    bc.code.reserve(prog.node_count() / 2 + 1);
+    std::vector<uint32_t> stack;
+    size_t max_depth = 0;
+    for (uint32_t index = 0; index < prog.node_count(); index++) {
+        const NodeKind kind = prog.kinds[index];
+        switch (kind) {
+            case NodeKind::int_lit:
+                stack.push_back(literal_base + prog.lhs[index]);
+                break;
+            case NodeKind::ident:
+                stack.push_back(prog.lhs[index]);
+                break;
+            case NodeKind::add:
+            case NodeKind::sub:
+            case NodeKind::mul:
+            case NodeKind::div: {
+                const uint32_t rhs = stack.back();
+                stack.pop_back();
+                const uint32_t lhs = stack.back();
+                stack.pop_back();
+                const auto dst = static_cast<uint32_t>(temp_base + stack.size());
+                stack.push_back(dst);
+                max_depth = std::max(max_depth, stack.size());
+                const BcOp op = kind == NodeKind::add ? BcOp::add
+                    : kind == NodeKind::sub ? BcOp::sub
+                    : kind == NodeKind::mul ? BcOp::mul
+                    : BcOp::div;
+                bc.code.push_back({.op = op, .dst = dst, .lhs = lhs, .rhs = rhs});
+                break;
+            }
+            case NodeKind::stmt_let: {
+                const uint32_t value = stack.back();
+                stack.pop_back();
+                // an initializer computed into a temporary is computed into the variable instead
+                if (value >= temp_base && !bc.code.empty() && bc.code.back().dst == value) {
+                    bc.code.back().dst = prog.rhs[index];
+                } else {
+                    bc.code.push_back({.op = BcOp::mov, .dst = prog.rhs[index], .lhs = value, .rhs = 0});
+                }
+                break;
+            }
+            case NodeKind::stmt_exit:
+                bc.code.push_back({.op = BcOp::exit, .dst = 0, .lhs = stack.back(), .rhs = 0});
+                stack.pop_back();
+                break;
+        }
+    }
+    bc.code.push_back({.op = BcOp::halt, .dst = 0, .lhs = 0, .rhs = 0});
+
+    bc.registers.resize(temp_base + max_depth, 0);
+    std::copy(prog.int_lits.begin(), prog.int_lits.end(), bc.registers.begin() + literal_base);
+    return bc;
+}
+
+// runs `bc` and returns the value passed to exit, or 0 if the program ends without exiting
+// dispatch is threaded with computed goto (a GCC / Clang extension): every handler jumps straight to the handler of
+// the next instruction, so each one has its own indirect branch for the predictor instead of all sharing the one of
+// a switch. arithmetic wraps like the machine instructions do, and a division the hardware would trap on raises SIGFPE, the
+// way the native program dies
+[[nodiscard]] inline int64_t interpret(const Bytecode& bc) {
+    // in BcOp order
+    static const void* const handlers[] = {&&op_mov, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_exit, &&op_halt};
+    std::vector<int64_t> registers = bc.registers;
+    int64_t* const r = registers.data();
+    const BcInstr* ip = bc.code.data();
+
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_mov:
+    r[ip->dst] = r[ip->lhs];
+    ip++;
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_add:
+    r[ip->dst] = static_cast<int64_t>(static_cast<uint64_t>(r[ip->lhs]) + static_cast<uint64_t>(r[ip->rhs]));
+    ip++;
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_sub:
+    r[ip->dst] = static_cast<int64_t>(static_cast<uint64_t>(r[ip->lhs]) - static_cast<uint64_t>(r[ip->rhs]));
+    ip++;
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_mul:
+    r[ip->dst] = static_cast<int64_t>(static_cast<uint64_t>(r[ip->lhs]) * static_cast<uint64_t>(r[ip->rhs]));
+    ip++;
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_div:
+    if (r[ip->rhs] == 0 || (r[ip->lhs] == INT64_MIN && r[ip->rhs] == -1)) {
+        std::signal(SIGFPE, SIG_DFL);
+        std::raise(SIGFPE);
+        std::abort();
+    }
+    r[ip->dst] = r[ip->lhs] / r[ip->rhs];
+    ip++;
+    goto *handlers[static_cast<uint32_t>(ip->op)];
+op_exit:
+    return r[ip->lhs];
+op_halt:
+    return 0;
+}
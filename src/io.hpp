@@ -0,0 +1,264 @@
+// Contains the file input/output used by the driver: memory mapped source files and a buffered output sink
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <span>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diagnostics.hpp"
+
+// maps a whole file read-only into memory so the tokenizer can read the source without copying it
+// pipes, FIFOs and other files without a size (`clear /dev/stdin`, `clear <(gen)`) cannot be mapped, they are read
+// to the end into a buffer instead
+class MappedFile {
+public:
+    inline explicit MappedFile(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fatal_error("Unable to open '", path, "': ", strerror(errno));
+        }
+
+        struct stat st {};
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            fatal_error("Unable to stat '", path, "': ", strerror(errno));
+        }
+        if (!S_ISREG(st.st_mode)) {
+            read_all(fd, path);
+            close(fd);
+            return;
+        }
+        m_size = static_cast<size_t>(st.st_size);
+
+        // mmap refuses zero length mappings, an empty file is simply an empty view
+        if (m_size > 0) {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                fatal_error("Unable to map '", path, "': ", strerror(errno));
+            }
+            madvise(data, m_size, MADV_SEQUENTIAL); // the tokenizer reads front to back exactly once
+            m_data = static_cast<const char*>(data);
+            m_mapped = true;
+        }
+        close(fd); // the mapping stays valid after the descriptor is closed
+    }
+
+    inline MappedFile(const MappedFile& other) = delete;
+
+    inline MappedFile& operator=(const MappedFile& other) = delete;
+
+    inline ~MappedFile() {
+        if (m_mapped) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    // view of the whole file, valid for the lifetime of this object
+    [[nodiscard]] inline std::string_view view() const {
+        return {m_data, m_size};
+    }
+
+private:
+    // reads `fd` until end of file into m_buffer
+    void read_all(int fd, const char* path) {
+        constexpr size_t chunk = 64 * 1024;
+        size_t size = 0;
+        while (true) {
+            m_buffer.resize(size + chunk);
+            const ssize_t got = read(fd, m_buffer.data() + size, chunk);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                const int err = errno;
+                close(fd);
+                fatal_error("Unable to read '", path, "': ", strerror(err));
+            }
+            if (got == 0) {
+                break;
+            }
+            size += static_cast<size_t>(got);
+        }
+        m_buffer.resize(size);
+        m_data = m_buffer.data();
+        m_size = size;
+    }
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false; // m_data is a mapping of the file rather than m_buffer
+    std::string m_buffer; // the contents of a file that could not be mapped
+};
+
+// fixed size output buffer that is written straight to a file descriptor whenever it fills up
+// used by the generator so the assembly is never held in memory as one big string
+class OutputBuffer {
+public:
+    static constexpr size_t default_capacity = 1024 * 1024; // 1mb
+
+    // takes ownership of `fd`
+    inline explicit OutputBuffer(int fd, size_t capacity = default_capacity)
+        : m_fd(fd),
+        m_capacity(capacity),
+        m_buffer(new char[capacity])
+    {
+    }
+
+    // opens (creating or truncating) `path` for writing
+    // an existing file is unlinked first, so an executable that is still running can be replaced
+    static inline int open_file(const char* path, mode_t mode = 0644) {
+        unlink(path);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        if (fd < 0) {
+            fatal_error("Unable to open '", path, "' for writing: ", strerror(errno));
+        }
+        return fd;
+    }
+
+    inline void write(std::string_view str) {
+        if (str.size() > m_capacity - m_size) {
+            flush();
+            // too big to ever fit the buffer, hand it to the kernel directly
+            if (str.size() > m_capacity) {
+                write_all(str.data(), str.size());
+                return;
+            }
+        }
+        memcpy(m_buffer + m_size, str.data(), str.size());
+        m_size += str.size();
+    }
+
+    inline OutputBuffer& operator<<(std::string_view str) {
+        write(str);
+        return *this;
+    }
+
+    inline OutputBuffer& operator<<(char c) {
+        if (m_size == m_capacity) {
+            flush();
+        }
+        m_buffer[m_size++] = c;
+        return *this;
+    }
+
+    // formats integers in place with to_chars instead of going through a locale aware stream
+    template<std::integral T>
+    inline OutputBuffer& operator<<(T value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        write({digits, static_cast<size_t>(result.ptr - digits)});
+        return *this;
+    }
+
+    // writes `pieces` one after the other with writev instead of copying them through the buffer
+    inline void write(std::span<const std::string> pieces) {
+        flush();
+        const auto start = std::chrono::steady_clock::now();
+        iovec iov[64];
+        size_t next = 0; // first piece not completely written
+        size_t offset = 0; // bytes of pieces[next] already written
+        while (next < pieces.size()) {
+            int count = 0;
+            for (size_t i = next; i < pieces.size() && count < static_cast<int>(std::size(iov)); i++) {
+                const size_t skip = i == next ? offset : 0;
+                iov[count++] = {.iov_base = const_cast<char*>(pieces[i].data() + skip), .iov_len = pieces[i].size() - skip};
+            }
+            const ssize_t written = ::writev(m_fd, iov, count);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fatal_error("Unable to write output: ", strerror(errno));
+            }
+            m_flushed += static_cast<size_t>(written);
+            // skip past what was written, a short write ends in the middle of a piece
+            size_t left = static_cast<size_t>(written);
+            while (next < pieces.size() && left >= pieces[next].size() - offset) {
+                left -= pieces[next].size() - offset;
+                next++;
+                offset = 0;
+            }
+            offset += left;
+        }
+        m_write_time += std::chrono::steady_clock::now() - start;
+    }
+
+    // writes out everything buffered so far, the buffer is then reused
+    inline void flush() {
+        write_all(m_buffer, m_size);
+        m_size = 0;
+    }
+
+    // overwrites `size` bytes at `offset` of the file, used to fill in headers once the sizes are known
+    inline void patch(size_t offset, const void* data, size_t size) {
+        flush();
+        const auto start = std::chrono::steady_clock::now();
+        if (pwrite(m_fd, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size)) {
+            fatal_error("Unable to write output: ", strerror(errno));
+        }
+        m_write_time += std::chrono::steady_clock::now() - start;
+    }
+
+    // total number of bytes passed to this buffer so far
+    [[nodiscard]] inline size_t bytes_written() const {
+        return m_flushed + m_size;
+    }
+
+    // time spent in write / pwrite so far
+    [[nodiscard]] inline double write_ms() const {
+        return m_write_time.count();
+    }
+
+    inline OutputBuffer(const OutputBuffer& other) = delete;
+
+    inline OutputBuffer& operator=(const OutputBuffer& other) = delete;
+
+    // nothing is flushed while an error of a batch compile unwinds, the output is incomplete anyway and throwing from
+    // here would terminate
+    inline ~OutputBuffer() {
+        if (std::uncaught_exceptions() == 0) {
+            flush();
+        }
+        delete[] m_buffer;
+        close(m_fd);
+    }
+
+private:
+    inline void write_all(const char* data, size_t size) {
+        const auto start = std::chrono::steady_clock::now();
+        while (size > 0) {
+            ssize_t written = ::write(m_fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fatal_error("Unable to write output: ", strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            m_flushed += static_cast<size_t>(written);
+        }
+        m_write_time += std::chrono::steady_clock::now() - start;
+    }
+
+    // member vars
+    int m_fd;
+    size_t m_capacity;
+    char* m_buffer;
+    size_t m_size = 0; // bytes currently buffered
+    size_t m_flushed = 0; // bytes already handed to the kernel
+    std::chrono::duration<double, std::milli> m_write_time {};
+};
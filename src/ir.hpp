@@ -0,0 +1,124 @@
+// Contains the linear three-address IR used by the optimizing backend and the lowering from the AST into it
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string_view>
+#include <cstdint>
+
+#include "parser.hpp"
+
+// operations available in the IR
+// every instruction defines at most one virtual register (vreg) and every vreg is defined exactly once,
+// so the straight line programs Clear can express are always in SSA form
+enum class IrOp : uint8_t {
+    imm, // dst = imm
+    copy, // dst = lhs
+    add, // dst = lhs + rhs
+    sub, // dst = lhs - rhs
+    mul, // dst = lhs * rhs
+    div, // dst = lhs / rhs, truncated toward zero
+    exit, // exit(lhs)
+};
+
+inline constexpr uint32_t no_vreg = UINT32_MAX;
+
+struct IrInstr {
+    IrOp op;
+    uint32_t dst = no_vreg;
+    uint32_t lhs = no_vreg;
+    uint32_t rhs = no_vreg;
+    int64_t imm = 0;
+};
+
+struct IrProgram {
+    std::vector<IrInstr> instrs;
+    uint32_t vreg_count = 0;
+};
+
+// walks the flat AST in index order and emits IR for it
+// since the nodes are in postorder the vregs of an operation's operands are always on top of the value stack
+// names must have been resolved (resolve_names), variables are looked up by symbol id without checks
+class IrLowering {
+public:
+    inline explicit IrLowering(const NodeProgram& prog)
+        : m_prog(prog),
+        m_vars(prog.symbols.size(), no_vreg)
+    {
+    }
+
+    void lower_node(uint32_t index) {
+        switch (m_prog.kinds[index]) {
+            case NodeKind::int_lit:
+                m_values.push_back(emit({.op = IrOp::imm, .imm = m_prog.int_lits[m_prog.lhs[index]]}));
+                break;
+            case NodeKind::ident:
+                m_values.push_back(m_vars[m_prog.lhs[index]]);
+                break;
+            case NodeKind::add:
+            case NodeKind::sub:
+            case NodeKind::mul:
+            case NodeKind::div: {
+                const uint32_t rhs = pop_value();
+                const uint32_t lhs = pop_value();
+                m_values.push_back(emit({.op = bin_ir_op(m_prog.kinds[index]), .lhs = lhs, .rhs = rhs}));
+                break;
+            }
+            case NodeKind::stmt_exit:
+                m_ir.instrs.push_back({.op = IrOp::exit, .lhs = pop_value()});
+                break;
+            case NodeKind::stmt_let:
+                // every let gets its own vreg through a copy, so the binding is visible to later passes
+                m_vars[m_prog.rhs[index]] = emit({.op = IrOp::copy, .lhs = pop_value()});
+                m_var_count++;
+                break;
+        }
+    }
+
+    // lowers the entire program (root)
+    [[nodiscard]] IrProgram lower_prog() {
+        for (uint32_t index = 0; index < m_prog.node_count(); index++) {
+            lower_node(index);
+        }
+        return std::move(m_ir);
+    }
+
+    // number of variables declared by the program
+    [[nodiscard]] inline size_t var_count() const {
+        return m_var_count;
+    }
+
+private:
+    static IrOp bin_ir_op(NodeKind kind) {
+        switch (kind) {
+            case NodeKind::sub:
+                return IrOp::sub;
+            case NodeKind::mul:
+                return IrOp::mul;
+            case NodeKind::div:
+                return IrOp::div;
+            default:
+                return IrOp::add;
+        }
+    }
+
+    // appends an instruction that defines a fresh vreg and returns that vreg
+    uint32_t emit(IrInstr instr) {
+        instr.dst = m_ir.vreg_count++;
+        m_ir.instrs.push_back(instr);
+        return instr.dst;
+    }
+
+    uint32_t pop_value() {
+        const uint32_t value = m_values.back();
+        m_values.pop_back();
+        return value;
+    }
+
+    // member vars
+    const NodeProgram& m_prog;
+    IrProgram m_ir;
+    std::vector<uint32_t> m_values; // vregs of the expression nodes visited but not consumed yet
+    std::vector<uint32_t> m_vars; // symbol id -> vreg holding the variable's value
+    size_t m_var_count = 0;
+};
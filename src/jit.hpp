@@ -0,0 +1,109 @@
+// Contains the JIT backend used by --run: machine code is encoded into executable memory and called in process
+#pragma once
+
+#include <iostream>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+
+#include "x86.hpp"
+#include "encoder.hpp"
+
+// collects encoded instructions in an anonymous read/write mapping that grows as needed
+// finish() flips the mapping to read/execute, after which run() calls the code as `int64_t f()`
+class JitBuffer {
+public:
+    static constexpr size_t initial_capacity = 1024 * 64; // 64kb
+
+    inline JitBuffer() {
+        m_code = map(initial_capacity);
+        m_capacity = initial_capacity;
+    }
+
+    void write(std::span<const Instr> code) {
+        for (const Instr& instr : code) {
+            if (m_capacity - m_size < X86Encoder::max_instr_size) {
+                grow();
+            }
+            m_size += X86Encoder::encode(instr, m_code + m_size);
+        }
+    }
+
+    // pieces of the program encoded by X86Encoder::encode, possibly on other threads, in program order
+    static void encode(std::span<const Instr> code, std::string& out) {
+        X86Encoder::encode(code, out);
+    }
+
+    void write_encoded(std::span<const std::string> pieces) {
+        for (const std::string& piece : pieces) {
+            while (m_capacity - m_size < piece.size()) {
+                grow();
+            }
+            memcpy(m_code + m_size, piece.data(), piece.size());
+            m_size += piece.size();
+        }
+    }
+
+    void finish() {
+        if (mprotect(m_code, m_capacity, PROT_READ | PROT_EXEC) != 0) {
+            std::cerr << "Unable to make JIT code executable: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_executable = true;
+    }
+
+    // runs the program and returns the value it exited with
+    [[nodiscard]] int64_t run() const {
+        if (!m_executable) {
+            std::cerr << "JIT code has not been finished" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        auto entry = reinterpret_cast<int64_t (*)()>(m_code);
+        return entry();
+    }
+
+    // bytes of machine code written so far
+    [[nodiscard]] inline size_t code_size() const {
+        return m_size;
+    }
+
+    inline JitBuffer(const JitBuffer& other) = delete;
+
+    inline JitBuffer& operator=(const JitBuffer& other) = delete;
+
+    inline ~JitBuffer() {
+        munmap(m_code, m_capacity);
+    }
+
+private:
+    static uint8_t* map(size_t size) {
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            std::cerr << "Unable to map JIT memory: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return static_cast<uint8_t*>(mem);
+    }
+
+    // the generated code only uses rsp / rbp relative addressing, so it can be moved freely while it is written
+    void grow() {
+        const size_t capacity = m_capacity * 2;
+        void* mem = mremap(m_code, m_capacity, capacity, MREMAP_MAYMOVE);
+        if (mem == MAP_FAILED) {
+            std::cerr << "Unable to grow JIT memory: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_code = static_cast<uint8_t*>(mem);
+        m_capacity = capacity;
+    }
+
+    // member vars
+    uint8_t* m_code;
+    size_t m_capacity;
+    size_t m_size = 0;
+    bool m_executable = false;
+};
@@ -1,54 +1,466 @@
 // TODO: 8:21 pt.2
 
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <optional>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <algorithm>
+#include <thread>
+#include <new>
+#include <cstdlib>
+
+#include <spawn.h>
+#include <sys/wait.h>
 
 #include "parser.hpp"
 #include "tokenization.hpp"
 #include "generation.hpp"
-#include "arena.hpp"
+#include "io.hpp"
+#include "stats.hpp"
+#include "parallel_front.hpp"
+#include "resolve.hpp"
+#include "thread_pool.hpp"
+#include "cache.hpp"
+#include "server.hpp"
+#include "interp.hpp"
 
-int main(int argc, char* argv[]) {
+// counts every heap allocation for --time-report / --stats, two relaxed increments are cheap enough to always do
+void* operator new(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// what the command line asks for
+struct Options {
+    std::vector<const char*> paths; // the files to compile, more than one only with -o
+    const char* out_dir = nullptr; // -o DIR: batch mode, every file is compiled into DIR under its own name
+    OptLevel opt_level = OptLevel::O0;
+    bool time_passes = false;
+    bool emit_asm = false; // -S: write nasm text to out.asm instead of building the executable in process
+    bool use_nasm = false; // --nasm: write out.asm and assemble / link it with nasm and ld
+    bool run = false; // --run: JIT the program and run it in process, no files are written
+    bool interp = false; // --interp: run the program on the bytecode interpreter, no machine code at all
+    bool stream = false; // --stream: tokenize, parse and generate one statement at a time, -O0 only
+    bool time_report = false; // --time-report: per phase times, allocations and sizes, human readable
+    bool stats_json = false; // --stats: the same as JSON
+    size_t jobs = 0; // -j N: threads for the front end and -O0 codegen, or for the files of a batch (all cores if not given)
+    Peephole peephole; // --no-peephole[=rule,...]: turn off all or some of its rules
+    bool use_cache = true; // --no-cache: always compile, neither look up nor store outputs
+    std::filesystem::path cache_dir = CompileCache::default_dir(); // --cache-dir=DIR
+    uint64_t cache_max_bytes = CompileCache::default_max_bytes; // --cache-size=MB
+};
+
+// where the outputs of one file go, only the ones its output mode produces are written
+struct OutputPaths {
+    std::string asm_file = "out.asm";
+    std::string object_file = "out.o";
+    std::string executable = "out";
+};
+
+// nullopt after printing what is wrong with the command line
+static std::optional<Options> parse_args(int argc, char* argv[]) {
     // expects an additional command-level argument referencing path to the clear script to run
-    if (argc != 2) {
+    // optionally preceded by an optimization level flag
+    Options options;
+    bool incorrect = false;
+    for (int i = 1; i < argc && !incorrect; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "-O0") {
+            options.opt_level = OptLevel::O0;
+        } else if (arg == "-O1") {
+            options.opt_level = OptLevel::O1;
+        } else if (arg == "-O2") {
+            options.opt_level = OptLevel::O2;
+        } else if (arg == "--time-passes") {
+            options.time_passes = true;
+        } else if (arg == "-S") {
+            options.emit_asm = true;
+        } else if (arg == "--nasm") {
+            options.use_nasm = true;
+        } else if (arg == "--run") {
+            options.run = true;
+        } else if (arg == "--interp") {
+            options.interp = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--time-report") {
+            options.time_report = true;
+        } else if (arg == "--stats") {
+            options.stats_json = true;
+        } else if (arg == "--no-peephole") {
+            options.peephole.disable_all();
+        } else if (arg.starts_with("--no-peephole=")) {
+            std::string_view rules = arg.substr(arg.find('=') + 1);
+            while (!rules.empty()) {
+                const std::string_view rule = rules.substr(0, rules.find(','));
+                if (!options.peephole.disable(rule)) {
+                    std::cerr << "Unknown peephole rule: " << rule << std::endl;
+                    return {};
+                }
+                rules.remove_prefix(std::min(rules.size(), rule.size() + 1));
+            }
+        } else if (arg == "--no-cache") {
+            options.use_cache = false;
+        } else if (arg.starts_with("--cache-dir=")) {
+            options.cache_dir = arg.substr(arg.find('=') + 1);
+        } else if (arg.starts_with("--cache-size=") && std::atoll(argv[i] + arg.find('=') + 1) > 0) {
+            options.cache_max_bytes = static_cast<uint64_t>(std::atoll(argv[i] + arg.find('=') + 1)) * 1024 * 1024;
+        } else if (arg == "-j" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            options.jobs = static_cast<size_t>(std::atoi(argv[++i]));
+        } else if (arg == "-o" && i + 1 < argc) {
+            options.out_dir = argv[++i];
+        } else if (!arg.starts_with("-")) {
+            options.paths.push_back(argv[i]);
+        } else {
+            incorrect = true;
+        }
+    }
+    // several files need somewhere to put their outputs
+    if (incorrect || options.paths.empty() || (options.paths.size() > 1 && options.out_dir == nullptr)) {
         std::cerr << "Incorrect call" << std::endl;
-        std::cerr << "Example: ./clear <../example_script.clr>" << std::endl;
-        return EXIT_FAILURE;
+        std::cerr << "Example: ./clear [-O0|-O1|-O2] [-S|--nasm|--run|--interp] [--stream] [--time-passes] [--no-peephole[=rule,...]] [--no-cache|--cache-dir=DIR|--cache-size=MB] [--time-report|--stats] [-j threads] <../example_script.clr>" << std::endl;
+        std::cerr << "   or: ./clear [options] -o <outdir> <a.clr> <b.clr>..." << std::endl;
+        std::cerr << "   or: ./clear --server[=socket]" << std::endl;
+        return {};
     }
-    
-    // read entire source file into a stream, then into a string
-    std::string contents;
+    // the other backends need the whole program at once
+    if (options.stream && (options.opt_level != OptLevel::O0 || options.interp)) {
+        std::cerr << "--stream only works at -O0 and cannot be combined with --interp" << std::endl;
+        return {};
+    }
+    return options;
+}
+
+// runs an external tool like nasm or ld and waits for it, an error unless it exits with status 0
+static void run_tool(std::vector<std::string> args) {
+    std::vector<char*> argv;
+    for (std::string& arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    pid_t pid = 0;
+    if (const int err = posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ); err != 0) {
+        fatal_error("Unable to run ", args[0], ": ", strerror(err));
+    }
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fatal_error(args[0], " failed on ", args.back());
+    }
+}
+
+// compiles the file at `path` into `out`, or runs it with --run, and returns the exit status
+// `jobs` threads tokenize and parse the file and generate -O0 code
+// errors exit, or throw a CompileError in a batch (see fatal_error)
+static int compile_file(const Options& options, const char* path, const OutputPaths& out, size_t jobs, Stats& stats) {
+    // map the source file into memory, the tokenizer and every token only hold views into it
+    // so it has to stay mapped until codegen is done
+    std::optional<MappedFile> source;
     {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in); 
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+        Stats::Phase phase(stats, "read");
+        source.emplace(path);
     }
+    stats.source_bytes = source->view().size();
 
-    Tokenizer tokenizer(std::move(contents));
-    // convert source string to tokens using the tokenize function
-    std::vector<Token> tokens = tokenizer.tokenize();
+    // outputs are cached by source, compiler and every flag that changes them, a hit skips every other phase
+    // --run and --interp write nothing, so there is nothing to cache. --stream skips it too, the key hashes all of
+    // the source before anything is compiled and storing copies all of the output
+    const bool text = options.emit_asm || options.use_nasm;
+    std::vector<std::filesystem::path> outputs;
+    if (options.use_nasm) {
+        outputs = {out.asm_file, out.object_file, out.executable};
+    } else {
+        outputs = {text ? out.asm_file : out.executable};
+    }
+    std::optional<CompileCache> cache;
+    std::string cache_key;
+    bool cache_hit = false;
+    if (options.use_cache && !options.run && !options.interp && !options.stream && !options.cache_dir.empty()) {
+        Stats::Phase phase(stats, "cache lookup");
+        std::string flags = "O" + std::to_string(static_cast<int>(options.opt_level));
+        flags += options.use_nasm ? " nasm" : options.emit_asm ? " asm" : " elf";
+        for (const Peephole::Rule& rule : options.peephole.rules()) {
+            if (!rule.enabled) {
+                flags += " no-";
+                flags += rule.name;
+            }
+        }
+        cache.emplace(options.cache_dir, options.cache_max_bytes);
+        cache_key = CompileCache::key(source->view(), flags);
+        cache_hit = cache->restore(cache_key, source->view(), outputs);
+    }
+    if (cache_hit) {
+        return EXIT_SUCCESS;
+    }
+
+    // the same threads tokenize and parse, then generate -O0 code
+    std::optional<ThreadPool> pool;
+    if (jobs > 1) {
+        pool.emplace(jobs);
+    }
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProgram> prog = parser.parse_prog();
+    std::optional<NodeProgram> prog;
+    std::optional<Tokenizer> stream_tokenizer;
+    std::optional<Parser> stream_parser;
+    if (options.stream) {
+        // nothing is tokenized or parsed up front, the generator pulls the statements from the parser one at a time
+        stream_parser.emplace(stream_tokenizer.emplace(source->view()));
+        prog.emplace();
+    } else if (pool.has_value()) {
+        // tokenize and parse pieces of the source on several threads, the phases overlap so they are timed together
+        Stats::Phase phase(stats, "tokenize+parse");
+        FrontEndResult result = ParallelFrontEnd(pool.value()).parse(source->view());
+        stats.tokens = result.token_count;
+        stats.token_bytes_reserved = result.token_bytes_reserved;
+        prog = std::move(result.prog);
+    } else {
+        // convert source string to tokens using the tokenize function
+        Tokenizer tokenizer(source->view());
+        std::vector<Token> tokens;
+        {
+            Stats::Phase phase(stats, "tokenize");
+            tokens = tokenizer.tokenize();
+        }
+        stats.tokens = tokens.size();
+        stats.token_bytes_reserved = tokens.capacity() * sizeof(Token);
+
+        Stats::Phase phase(stats, "parse");
+        prog = Parser(std::move(tokens), tokenizer.take_symbols()).parse_prog();
+    }
 
     if (!prog.has_value()) {
-        std::cerr << "Unable to parse tokens" << std::endl;
-        exit(EXIT_FAILURE);
+        fatal_error("Unable to parse tokens");
+    }
+    stats.ast_nodes = prog->node_count();
+    stats.ast_bytes_used = prog->bytes_used();
+    stats.ast_bytes_reserved = prog->bytes_reserved();
+
+    // every name is checked once here, codegen then indexes variables by symbol id
+    // a streamed program is checked statement by statement as it is generated
+    if (!options.stream) {
+        Stats::Phase phase(stats, "resolve");
+        resolve_names(prog.value());
     }
 
-    Generator generator(prog.value());
-    
+    // when streaming all the front end runs inside codegen, so the phase covers all of it
+    const std::string_view generate_phase = options.stream ? "stream" : "generate";
+    const auto generate = [&](Generator& generator) {
+        {
+            Stats::Phase phase(stats, generate_phase);
+            if (stream_parser.has_value()) {
+                generator.generate_stream(stream_parser.value());
+            } else {
+                generator.generate_prog(pool.has_value() ? &pool.value() : nullptr);
+            }
+        }
+        if (options.time_passes) {
+            generator.pass_manager().report(std::cerr);
+            generator.peephole().report(std::cerr);
+        }
+        stats.vars = generator.var_count();
+        stats.peak_stack_size = generator.peak_stack_size();
+        if (stream_parser.has_value()) {
+            stats.tokens = stream_parser->token_count();
+            stats.token_bytes_reserved = stream_parser->token_bytes_reserved();
+            stats.ast_nodes = stream_parser->node_count();
+            stats.ast_bytes_reserved = stream_parser->ast_bytes_reserved();
+        }
+    };
+
+    // evaluate the program on the interpreter, the value passed to exit becomes our exit status like with --run
+    if (options.interp) {
+        Bytecode bc;
+        {
+            Stats::Phase phase(stats, "bytecode");
+            bc = compile_bytecode(prog.value());
+        }
+        stats.vars = prog->symbols.size();
+        stats.output_bytes = bc.bytes();
+        return static_cast<int>(interpret(bc));
+    }
+
+    // compile straight into executable memory and run it, the program's exit value becomes our exit status
+    if (options.run) {
+        JitBuffer jit;
+        Generator generator(std::move(prog.value()), &jit, options.opt_level, options.peephole);
+        generate(generator);
+        stats.output_bytes = jit.code_size();
+        return static_cast<int>(jit.run());
+    }
+
+    // code is streamed through a fixed size buffer straight into the output file:
+    // either nasm text, or an executable encoded in process so no assembler or linker has to run
     {
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.generate_prog();
+        OutputBuffer output(text ? OutputBuffer::open_file(out.asm_file.c_str())
+                                 : OutputBuffer::open_file(out.executable.c_str(), 0755));
+        std::optional<AsmWriter> asm_writer;
+        std::optional<ElfWriter> elf_writer;
+        CodeSink sink;
+        if (text) {
+            sink = &asm_writer.emplace(output);
+        } else {
+            sink = &elf_writer.emplace(output);
+        }
+
+        Generator generator(std::move(prog.value()), sink, options.opt_level, options.peephole);
+        // a streamed program can fail after part of it was written (its errors are thrown, see compile), the
+        // incomplete output is removed so nothing takes it for a good one
+        try {
+            generate(generator);
+        } catch (const CompileError&) {
+            unlink(text ? out.asm_file.c_str() : out.executable.c_str());
+            throw;
+        }
+        // write errors are reported here rather than from the destructor
+        output.flush();
+        // the output is written in chunks while generating, report the time spent in the kernel on its own
+        stats.split_phase(generate_phase, text ? "write out.asm" : "write out", output.write_ms());
+        stats.output_bytes = output.bytes_written();
     }
 
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
+    if (options.use_nasm) {
+        {
+            Stats::Phase phase(stats, "nasm");
+            run_tool({"nasm", "-felf64", "-o", out.object_file, out.asm_file});
+        }
+        {
+            Stats::Phase phase(stats, "ld");
+            run_tool({"ld", "-o", out.executable, out.object_file});
+        }
+    }
 
+    if (cache.has_value()) {
+        Stats::Phase phase(stats, "cache store");
+        cache->store(cache_key, source->view(), outputs);
+    }
+    return EXIT_SUCCESS;
+}
+
+// -o: compiles every file into the output directory, several files at once
+// each file is compiled start to finish by one thread with its own tokenizer, parser and generator. a failing file
+// does not stop the others, the errors are printed in command line order once all files are done
+static int compile_batch(const Options& options) {
+    if (options.run || options.interp || options.time_passes || options.time_report || options.stats_json) {
+        std::cerr << "-o cannot be combined with --run, --interp, --time-passes, --time-report or --stats" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(options.out_dir, ec);
+    if (ec) {
+        std::cerr << "Unable to create '" << options.out_dir << "': " << ec.message() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // a.clr becomes <outdir>/a.asm, <outdir>/a.o and the executable <outdir>/a
+    const size_t count = options.paths.size();
+    std::vector<OutputPaths> outputs(count);
+    std::vector<std::string> stems(count);
+    for (size_t i = 0; i < count; i++) {
+        stems[i] = std::filesystem::path(options.paths[i]).stem().string();
+        const std::filesystem::path base = std::filesystem::path(options.out_dir) / stems[i];
+        outputs[i] = {.asm_file = base.string() + ".asm", .object_file = base.string() + ".o", .executable = base.string()};
+    }
+    std::vector<std::string> sorted_stems = stems;
+    std::sort(sorted_stems.begin(), sorted_stems.end());
+    if (const auto dup = std::adjacent_find(sorted_stems.begin(), sorted_stems.end()); dup != sorted_stems.end()) {
+        std::cerr << "Two input files would both be written to '" << *dup << "' in " << options.out_dir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // biggest files first, so a big file picked last does not keep one thread busy while the others are idle
+    std::vector<size_t> order(count);
+    std::vector<uintmax_t> sizes(count);
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+        sizes[i] = std::filesystem::file_size(options.paths[i], ec);
+        if (ec) {
+            sizes[i] = 0;
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+    std::vector<std::string> errors(count);
+    std::vector<char> failed(count, false);
+    const size_t threads = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(std::min(threads, count));
+    pool.parallel_for(count, [&](size_t job) {
+        const size_t i = order[job];
+        t_batch = true;
+        try {
+            Stats stats;
+            compile_file(options, options.paths[i], outputs[i], 1, stats);
+        } catch (const CompileError& error) {
+            errors[i] = error.message;
+            failed[i] = true;
+        }
+        t_batch = false;
+    });
+
+    size_t failures = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (failed[i]) {
+            std::cerr << options.paths[i] << ": " << errors[i] << std::endl;
+            failures++;
+        }
+    }
+    if (failures > 0) {
+        std::cerr << failures << " of " << count << " files failed to compile" << std::endl;
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+// compiles what the command line asks for, returns the exit status
+// main calls it directly, `clear --server` calls it in a child for every request
+static int compile(int argc, char* argv[]) {
+    std::optional<Options> options = parse_args(argc, argv);
+    if (!options.has_value()) {
+        return EXIT_FAILURE;
+    }
+    if (options->out_dir != nullptr) {
+        return compile_batch(options.value());
+    }
+
+    // every phase is timed, the report is only printed when asked for
+    // errors of a streamed program are thrown like a batch file's, so compile_file can clean up its partial output
+    Stats stats;
+    int status = EXIT_FAILURE;
+    t_batch = options->stream;
+    try {
+        status = compile_file(options.value(), options->paths[0], OutputPaths {}, std::max<size_t>(options->jobs, 1), stats);
+    } catch (const CompileError& error) {
+        std::cerr << error.message << std::endl;
+        return EXIT_FAILURE;
+    }
+    t_batch = false;
+    if (options->time_report) {
+        stats.report_text(std::cerr);
+    }
+    if (options->stats_json) {
+        stats.report_json(std::cerr);
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    // clear --server[=socket]: compile the requests of clear_client until interrupted
+    if (argc == 2 && (std::string_view(argv[1]) == "--server" || std::string_view(argv[1]).starts_with("--server="))) {
+        const std::string_view arg = argv[1];
+        const std::string socket_path = arg == "--server" ? default_socket_path() : std::string(arg.substr(arg.find('=') + 1));
+        return CompileServer(socket_path, compile).run();
+    }
+    return compile(argc, argv);
+}
@@ -0,0 +1,187 @@
+// Contains the parallel front end: the source is cut at statement boundaries and the pieces are tokenized and parsed
+// on a thread pool, then stitched into one flat AST in source order
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "diagnostics.hpp"
+#include "thread_pool.hpp"
+
+struct FrontEndResult {
+    NodeProgram prog;
+    size_t token_count = 0;
+    // capacity of the token buffers, summed over the chunks when the source was split
+    size_t token_bytes_reserved = 0;
+};
+
+// tokenizes and parses on a single thread
+[[nodiscard]] inline FrontEndResult parse_serial(std::string_view src) {
+    FrontEndResult result;
+    Tokenizer tokenizer(src);
+    std::vector<Token> tokens = tokenizer.tokenize();
+    result.token_count = tokens.size();
+    result.token_bytes_reserved = tokens.capacity() * sizeof(Token);
+    std::optional<NodeProgram> prog = Parser(std::move(tokens), tokenizer.take_symbols()).parse_prog();
+    if (!prog.has_value()) {
+        front_end_error("Unable to parse tokens");
+    }
+    result.prog = std::move(prog.value());
+    return result;
+}
+
+class ParallelFrontEnd {
+public:
+    // sources smaller than this are not worth splitting
+    static constexpr size_t min_chunk_size = 256 * 1024; // 256kb
+    // chunks per thread, so a thread that got cheap chunks can pick up more
+    static constexpr size_t chunks_per_thread = 4;
+
+    inline explicit ParallelFrontEnd(ThreadPool& pool)
+        : m_pool(pool)
+    {
+    }
+
+    // produces the same program and the same diagnostics as parse_serial
+    // Clear has no strings or comments, so every `;` ends a statement and cutting right after one can never split
+    // a token or a statement. chunks are parsed speculatively: if any of them fails the whole source goes through
+    // parse_serial, which reports the first error exactly like the serial path does
+    [[nodiscard]] FrontEndResult parse(std::string_view src) {
+        const std::vector<std::string_view> pieces = split(src);
+        if (pieces.size() <= 1) {
+            return parse_serial(src);
+        }
+
+        std::vector<Chunk> chunks(pieces.size());
+        m_pool.parallel_for(pieces.size(), [&](size_t index) {
+            t_speculative = true;
+            try {
+                chunks[index].result = parse_serial(pieces[index]);
+            } catch (const FrontEndError&) {
+                chunks[index].failed = true;
+            }
+            t_speculative = false;
+        });
+        for (const Chunk& chunk : chunks) {
+            if (chunk.failed) {
+                return parse_serial(src);
+            }
+        }
+
+        return stitch(chunks);
+    }
+
+private:
+    struct Chunk {
+        FrontEndResult result;
+        bool failed = false;
+        // where the chunk's entries start in the stitched arrays
+        uint32_t node_base = 0;
+        uint32_t int_lit_base = 0;
+        uint32_t stmt_base = 0;
+        std::vector<uint32_t> symbol_ids; // chunk symbol id -> id in the stitched program
+    };
+
+    // cuts `src` into roughly equal pieces, each ending right after a `;` (or at the end of the source)
+    [[nodiscard]] std::vector<std::string_view> split(std::string_view src) const {
+        const size_t wanted = std::min(m_pool.thread_count() * chunks_per_thread, src.size() / min_chunk_size);
+        std::vector<std::string_view> pieces;
+        size_t start = 0;
+        for (size_t i = 1; i < wanted && start < src.size(); i++) {
+            const size_t target = std::max(start, src.size() / wanted * i);
+            const void* semi = memchr(src.data() + target, ';', src.size() - target);
+            if (semi == nullptr) {
+                break;
+            }
+            const size_t end = static_cast<size_t>(static_cast<const char*>(semi) - src.data()) + 1;
+            pieces.push_back(src.substr(start, end - start));
+            start = end;
+        }
+        if (start < src.size() || pieces.empty()) {
+            pieces.push_back(src.substr(start));
+        }
+        return pieces;
+    }
+
+    // concatenates the chunk programs, shifting every index a node holds by where its target array starts
+    // each chunk interned its identifiers on its own, the chunk symbol tables are merged in source order
+    // so every name gets the same id the serial tokenizer would have given it
+    [[nodiscard]] FrontEndResult stitch(std::vector<Chunk>& chunks) {
+        FrontEndResult result;
+        SymbolTable symbols;
+        size_t nodes = 0;
+        size_t int_lits = 0;
+        size_t stmts = 0;
+        for (Chunk& chunk : chunks) {
+            const NodeProgram& prog = chunk.result.prog;
+            chunk.node_base = static_cast<uint32_t>(nodes);
+            chunk.int_lit_base = static_cast<uint32_t>(int_lits);
+            chunk.stmt_base = static_cast<uint32_t>(stmts);
+            chunk.symbol_ids.reserve(prog.symbols.size());
+            for (std::string_view name : prog.symbols) {
+                chunk.symbol_ids.push_back(symbols.intern(name));
+            }
+            nodes += prog.node_count();
+            int_lits += prog.int_lits.size();
+            stmts += prog.stmts.size();
+            result.token_count += chunk.result.token_count;
+            result.token_bytes_reserved += chunk.result.token_bytes_reserved;
+        }
+
+        NodeProgram& out = result.prog;
+        out.kinds.resize(nodes);
+        out.lhs.resize(nodes);
+        out.rhs.resize(nodes);
+        out.int_lits.resize(int_lits);
+        out.stmts.resize(stmts);
+        out.symbols = symbols.take_names();
+
+        // every chunk writes its own disjoint ranges, so the copies run in parallel too
+        m_pool.parallel_for(chunks.size(), [&](size_t index) {
+            const Chunk& chunk = chunks[index];
+            const NodeProgram& prog = chunk.result.prog;
+            std::copy(prog.kinds.begin(), prog.kinds.end(), out.kinds.begin() + chunk.node_base);
+            std::copy(prog.int_lits.begin(), prog.int_lits.end(), out.int_lits.begin() + chunk.int_lit_base);
+            for (size_t i = 0; i < prog.stmts.size(); i++) {
+                out.stmts[chunk.stmt_base + i] = prog.stmts[i] + chunk.node_base;
+            }
+            for (size_t i = 0; i < prog.node_count(); i++) {
+                uint32_t lhs = prog.lhs[i];
+                uint32_t rhs = prog.rhs[i];
+                switch (prog.kinds[i]) {
+                    case NodeKind::int_lit:
+                        lhs += chunk.int_lit_base;
+                        break;
+                    case NodeKind::ident:
+                        lhs = chunk.symbol_ids[lhs];
+                        break;
+                    case NodeKind::add:
+                    case NodeKind::sub:
+                    case NodeKind::mul:
+                    case NodeKind::div:
+                        lhs += chunk.node_base;
+                        rhs += chunk.node_base;
+                        break;
+                    case NodeKind::stmt_exit:
+                        lhs += chunk.node_base;
+                        break;
+                    case NodeKind::stmt_let:
+                        lhs += chunk.node_base;
+                        rhs = chunk.symbol_ids[rhs];
+                        break;
+                }
+                out.lhs[chunk.node_base + i] = lhs;
+                out.rhs[chunk.node_base + i] = rhs;
+            }
+        });
+        return result;
+    }
+
+    // member vars
+    ThreadPool& m_pool;
+};
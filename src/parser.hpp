@@ -1,102 +1,147 @@
 // Contians all functionality relevant to parsing tokens into an AST
 #pragma once
 
+#include <iostream>
 #include <vector>
 #include <optional>
-#include <variant>
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <span>
 
 #include "tokenization.hpp"
-#include "arena.hpp"
+#include "diagnostics.hpp"
 
-// nodes used to construct the AST
-// ranging from furthest from the root (top of the list) to the root (bottom of the list)
+// the AST is stored flat: every node is an index into a set of parallel arrays instead of a separately
+// allocated object. children are always appended before their parents, so the nodes are in postorder
+// and walking them by increasing index visits every operand before the operation that uses it
 
-// contained in expressions
-struct NodeExprIntLit {
-    Token int_lit;
+// kinds of nodes, and what `lhs` / `rhs` hold for each of them
+enum class NodeKind : uint8_t {
+    int_lit, // lhs: index into NodeProgram::int_lits
+    ident, // lhs: symbol id
+    add, // lhs, rhs: operand nodes
+    sub, // lhs, rhs: operand nodes
+    mul, // lhs, rhs: operand nodes
+    div, // lhs, rhs: operand nodes
+    stmt_exit, // lhs: expression node
+    stmt_let, // lhs: expression node, rhs: symbol id of the declared name
 };
-struct NodeExprIdent {
-    Token ident;
-};
-
-struct NodeExpr;
 
-struct NodeBinExprAdd {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-    
-};
-// struct NodeBinExprMulti {
-//     NodeExpr* lhs;
-//     NodeExpr* rhs;
-// };
-
-struct NodeTermIntLit {
-    Token int_lit;
-};
+// root node (program)
+struct NodeProgram {
+    // one entry per node
+    std::vector<NodeKind> kinds;
+    std::vector<uint32_t> lhs;
+    std::vector<uint32_t> rhs;
 
-struct NodeTermIdent {
-    Token ident;
-};
+    // literal payloads
+    std::vector<int64_t> int_lits;
+    std::vector<std::string_view> symbols; // symbol id -> name, views into the source
 
-struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*> var;
-};
+    std::vector<uint32_t> stmts; // statement nodes in program order
 
-// struct NodeBinExpr {
-//     std::variant<NodeBinExprAdd*, NodeBinExprMulti*> var;
-// };
-struct NodeBinExpr {
-    NodeBinExprAdd* add;
-};
+    [[nodiscard]] constexpr size_t node_count() const {
+        return kinds.size();
+    }
 
-struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
+    // bytes held by the arrays vs bytes they have allocated
+    [[nodiscard]] inline size_t bytes_used() const {
+        return kinds.size() * sizeof(NodeKind) + (lhs.size() + rhs.size() + stmts.size()) * sizeof(uint32_t)
+            + int_lits.size() * sizeof(int64_t) + symbols.size() * sizeof(std::string_view);
+    }
+    [[nodiscard]] inline size_t bytes_reserved() const {
+        return kinds.capacity() * sizeof(NodeKind) + (lhs.capacity() + rhs.capacity() + stmts.capacity()) * sizeof(uint32_t)
+            + int_lits.capacity() * sizeof(int64_t) + symbols.capacity() * sizeof(std::string_view);
+    }
 
-// contained in statements
-struct NodeStmtExit {
-    NodeExpr* expr;
-};
-struct NodeStmtLet {
-    Token ident;
-    NodeExpr* expr;
+    // appends a node and returns its index
+    constexpr uint32_t add_node(NodeKind kind, uint32_t lhs_index, uint32_t rhs_index = 0) {
+        kinds.push_back(kind);
+        lhs.push_back(lhs_index);
+        rhs.push_back(rhs_index);
+        return static_cast<uint32_t>(kinds.size() - 1);
+    }
 };
 
-struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtLet*> var;
-};
+// true for the node kinds of binary operators
+[[nodiscard]] inline constexpr bool is_bin_expr(NodeKind kind) {
+    return kind == NodeKind::add || kind == NodeKind::sub || kind == NodeKind::mul || kind == NodeKind::div;
+}
 
+// binary operator node and precedence (higher binds tighter) for a token, nothing if it is not an operator
+// the precedences follow the grammar in README.md
+[[nodiscard]] inline constexpr std::optional<std::pair<NodeKind, int>> bin_op(TokenType type) {
+    switch (type) {
+        case TokenType::plus:
+            return {{NodeKind::add, 0}};
+        case TokenType::minus:
+            return {{NodeKind::sub, 0}};
+        case TokenType::multi:
+            return {{NodeKind::mul, 1}};
+        case TokenType::div:
+            return {{NodeKind::div, 1}};
+        default:
+            return {};
+    }
+}
 
-// root node (program)
-struct NodeProgram {
-    std::vector<NodeStmt*> stmts;
-};
+// parses the digits of an integer literal token, exits if it does not fit in 64 bits
+[[nodiscard]] inline constexpr int64_t parse_int_lit(const Token& int_lit) {
+    int64_t value = 0;
+    // from_chars is not constexpr before C++23, the compile time front end (embed.hpp) parses the digits itself
+    if (std::is_constant_evaluated()) {
+        for (char digit : int_lit.value) {
+            if (value > (INT64_MAX - (digit - '0')) / 10) {
+                front_end_error("Integer literal out of range: ", int_lit.value);
+            }
+            value = value * 10 + (digit - '0');
+        }
+        return value;
+    }
+    auto result = std::from_chars(int_lit.value.data(), int_lit.value.data() + int_lit.value.size(), value);
+    if (result.ec != std::errc()) {
+        front_end_error("Integer literal out of range: ", int_lit.value);
+    }
+    return value;
+}
 
+// every member is constexpr, so the compile time front end (embed.hpp) runs this same parser inside the C++ compiler
 class Parser {
 public:
-    explicit Parser(std::vector<Token> tokens)
-        : m_tokens(std::move(tokens)),
-        m_allocator(1024 * 1024 * 4) // 4mb
+    // `symbols` are the names of the symbol ids the identifier tokens carry (Tokenizer::take_symbols)
+    constexpr explicit Parser(std::vector<Token> tokens, std::vector<std::string_view> symbols)
+        : m_tokens(std::move(tokens))
+    {
+        m_prog.symbols = std::move(symbols);
+        // rough guess so the node arrays do not reallocate over and over on big inputs
+        const size_t nodes = m_tokens.size() / 2 + 16;
+        m_prog.kinds.reserve(nodes);
+        m_prog.lhs.reserve(nodes);
+        m_prog.rhs.reserve(nodes);
+    }
+
+    // streams the tokens from `tokenizer`: they are lexed on demand into a window of `window` tokens, so only the
+    // statement being parsed and a little lookahead are ever held (see next_stmt)
+    inline explicit Parser(Tokenizer& tokenizer, size_t window = stream_window)
+        : m_lexer(&tokenizer),
+        m_window(std::max<size_t>(window, max_lookahead))
     {
+        m_tokens.reserve(m_window);
     }
 
-    std::optional<NodeTerm*> parse_term() {
+    // returns the index of the term's node
+    constexpr std::optional<uint32_t> parse_term() {
         // handle integer literal
         if (auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-            term_int_lit->int_lit = int_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_int_lit;
-            return term;
+            m_prog.int_lits.push_back(parse_int_lit(*int_lit));
+            return m_prog.add_node(NodeKind::int_lit, static_cast<uint32_t>(m_prog.int_lits.size() - 1));
         }
         // handle identifier
         else if (auto ident = try_consume(TokenType::ident)) {
-            auto term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = ident.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
-            return term;
+            return m_prog.add_node(NodeKind::ident, ident->symbol);
         } 
         else {
             return {};
@@ -104,88 +149,86 @@ public:
     }
 
     // parses an expression, which can be a(n):
-    // integer literal, identifier
-    std::optional<NodeExpr*> parse_expr() {
-        if (auto term = parse_term()) {
-            if (try_consume(TokenType::plus).has_value()) {
-                auto bin_expr = m_allocator.alloc<NodeBinExpr>();
-                auto bin_expr_add = m_allocator.alloc<NodeBinExprAdd>();
-                auto lhs_expr = m_allocator.alloc<NodeExpr>();
-                lhs_expr->var = term.value();
-                bin_expr_add->lhs = lhs_expr;
-                if (auto rhs = parse_expr()) {
-                    bin_expr_add->rhs = rhs.value();
-                    // bin_expr->var = bin_expr_add;
-                    bin_expr->add = bin_expr_add; // MADE TEMP CHANGE HERE
-                    auto expr = m_allocator.alloc<NodeExpr>();
-                    expr->var = bin_expr;
-                    return expr;
-                } else {
-                    std::cerr << "Unable to parse expression on right hand side" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
+    // integer literal, identifier, or terms joined by + - * /
+    // returns the index of the expression's root node
+    //
+    // precedence climbing with explicit operand / operator stacks instead of recursion, so expressions of any
+    // length parse in linear time and constant C++ stack. an operator is only reduced once the next operator
+    // binds no tighter, which makes equal precedence chains left associative (a - b - c is (a - b) - c).
+    // reductions happen right after both operands exist, so the nodes still come out in postorder
+    constexpr std::optional<uint32_t> parse_expr() {
+        auto term = parse_term();
+        if (!term.has_value()) {
+            return {};
+        }
+        const size_t operands_base = m_operands.size();
+        const size_t operators_base = m_operators.size();
+        m_operands.push_back(term.value());
+
+        while (const Token* token = peek()) {
+            auto op = bin_op(token->type);
+            if (!op.has_value()) {
+                break;
+            }
+            consume();
+            while (m_operators.size() > operators_base && m_operators.back().second >= op->second) {
+                reduce();
+            }
+            m_operators.push_back(op.value());
+
+            if (auto rhs = parse_term()) {
+                m_operands.push_back(rhs.value());
             } else {
-                auto expr = m_allocator.alloc<NodeExpr>();
-                expr->var = term.value();
-                return expr;
+                front_end_error("Unable to parse expression on right hand side");
             }
-        } else {
-            return {};
         }
-        // handles binary expressions
-        // if (auto bin_expr = parse_bin_expr()) {
-        //     auto expr = m_allocator.alloc<NodeExpr>();
-        //     expr->var = bin_expr.value();
-        //     return expr;
-        // }
-        // unhandled expression
+        while (m_operators.size() > operators_base) {
+            reduce();
+        }
+
+        const uint32_t expr = m_operands.back();
+        m_operands.resize(operands_base);
+        return expr;
     }
 
     // parses an idividual statement from the vector of statements contained in program
     // available statements include:
     // exit, let
-    std::optional<NodeStmt*> parse_stmt() {
+    // returns the index of the statement's node
+    constexpr std::optional<uint32_t> parse_stmt() {
         // handle exit stmt
-        if (peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren) {
+        if (peek_is(TokenType::exit) && peek_is(TokenType::open_paren, 1)) {
             consume(); 
             consume(); 
-            auto stmt_exit = m_allocator.alloc<NodeStmtExit>();
+            uint32_t expr;
             if (auto node_expr = parse_expr()) { 
-                stmt_exit->expr = node_expr.value();
+                expr = node_expr.value();
             } else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                front_end_error("Invalid expression");
             }
             try_consume(TokenType::close_paren, "Expected `)`");
             try_consume(TokenType::semi, "Expected `;`");
 
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_exit; 
-            return stmt;
+            return m_prog.add_node(NodeKind::stmt_exit, expr);
         }
         // handle let stmt
-        else if (peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value() && peek(1).value().type == TokenType::ident && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
+        else if (peek_is(TokenType::let) && peek_is(TokenType::ident, 1) && peek_is(TokenType::eq, 2)) {
             consume(); // let
 
-            // allocate and store ident
-            auto stmt_let = m_allocator.alloc<NodeStmtLet>();
-            stmt_let->ident = consume();
+            const uint32_t ident = consume().symbol;
 
             consume(); // '='
 
-            if (auto expr = parse_expr()) {
-                stmt_let->expr = expr.value();
+            uint32_t expr;
+            if (auto node_expr = parse_expr()) {
+                expr = node_expr.value();
             } else {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                front_end_error("Invalid expression");
             }
             
             try_consume(TokenType::semi, "Expected `;`");
 
-            // return NodeStmt {.var = stmt_let};
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
+            return m_prog.add_node(NodeKind::stmt_let, expr, ident);
         }
         // unhandled stmt
         else {
@@ -195,55 +238,146 @@ public:
 
     // parses the program node's statements in a loop
     // top level parsing function
-    std::optional<NodeProgram> parse_prog() {
-        NodeProgram prog;
+    constexpr std::optional<NodeProgram> parse_prog() {
         // as long as there is a statement ahead in the tokens, parse it
-        while (peek().has_value()) {
+        while (peek() != nullptr) {
             if (auto stmt = parse_stmt()) {
-                prog.stmts.push_back(stmt.value()); // parse individual stmt
+                m_prog.stmts.push_back(stmt.value()); // parse individual stmt
             } else {
-                std::cerr << "failed to parse statement" << std::endl;
-                exit(EXIT_FAILURE);
+                front_end_error("failed to parse statement");
             }
         }
 
         // return the root node of the program
-        return prog;
+        add_new_symbols();
+        return std::move(m_prog);
+    }
+
+    // parses the next statement into a program of its own, nullptr at the end of the source
+    // the program and the memory of its arrays are reused for every statement, so parsing a source statement by
+    // statement takes memory for the largest statement rather than for all of them. its symbols are every name
+    // lexed so far, ids stay the same from statement to statement
+    constexpr const NodeProgram* next_stmt() {
+        m_node_count += m_prog.node_count();
+        m_prog.kinds.clear();
+        m_prog.lhs.clear();
+        m_prog.rhs.clear();
+        m_prog.int_lits.clear();
+        m_prog.stmts.clear();
+        if (peek() == nullptr) {
+            return nullptr;
+        }
+        if (auto stmt = parse_stmt()) {
+            m_prog.stmts.push_back(stmt.value());
+        } else {
+            front_end_error("failed to parse statement");
+        }
+        add_new_symbols();
+        return &m_prog;
+    }
+
+    // tokens consumed so far
+    [[nodiscard]] inline size_t token_count() const {
+        return m_token_count + m_index;
+    }
+
+    // nodes of the statements next_stmt returned, the current one included
+    [[nodiscard]] inline size_t node_count() const {
+        return m_node_count + m_prog.node_count();
+    }
+
+    // memory held for tokens and nodes, when streaming the most that was ever needed at once
+    [[nodiscard]] inline size_t token_bytes_reserved() const {
+        return m_tokens.capacity() * sizeof(Token);
+    }
+    [[nodiscard]] inline size_t ast_bytes_reserved() const {
+        return m_prog.bytes_reserved();
     }
 
 private:
+    // pops the top operator and its two operands and pushes the binary expression node made of them
+    constexpr void reduce() {
+        const uint32_t rhs = m_operands.back();
+        m_operands.pop_back();
+        const uint32_t lhs = m_operands.back();
+        m_operands.back() = m_prog.add_node(m_operators.back().first, lhs, rhs);
+        m_operators.pop_back();
+    }
+
     // peek ahead, this time with tokens, not just chars
-    [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const {
-        if (m_index + offset >= m_tokens.size()) {
-            return {};
+    // returns nullptr past the end of the token stream
+    // when streaming this may lex more tokens, which moves the window: a token returned earlier is only valid until
+    // the next peek
+    [[nodiscard]] constexpr const Token* peek(size_t offset = 0) {
+        if (m_index + offset >= m_tokens.size() && (m_lexer == nullptr || !refill(offset))) {
+            return nullptr;
+        }
+
+        return &m_tokens[m_index + offset];
+    }
+
+    // moves the tokens not consumed yet to the front of the window and lexes behind them until it is full
+    // false if the source ends before the token `offset` ahead
+    // the parser looks at most max_lookahead tokens ahead, so a few tokens are moved and the window is never grown
+    inline bool refill(size_t offset) {
+        m_token_count += m_index;
+        m_tokens.erase(m_tokens.begin(), m_tokens.begin() + static_cast<std::ptrdiff_t>(m_index));
+        m_index = 0;
+        const size_t kept = m_tokens.size();
+        m_tokens.resize(m_window);
+        m_tokens.resize(kept + m_lexer->fill(std::span<Token>(m_tokens).subspan(kept)));
+        return offset < m_tokens.size();
+    }
+
+    // names the tokenizer interned since the last call, when streaming
+    constexpr void add_new_symbols() {
+        if (m_lexer == nullptr) {
+            return;
+        }
+        const SymbolTable& symbols = m_lexer->symbols();
+        for (size_t id = m_prog.symbols.size(); id < symbols.size(); id++) {
+            m_prog.symbols.push_back(symbols.name(static_cast<uint32_t>(id)));
         }
+    }
 
-        return m_tokens.at(m_index + offset);
+    // true if the token `offset` ahead exists and has the given type
+    [[nodiscard]] constexpr bool peek_is(TokenType type, size_t offset = 0) {
+        const Token* token = peek(offset);
+        return token != nullptr && token->type == type;
     }
 
-    inline Token try_consume(TokenType type, const std::string& err_msg) {
-        if (peek().has_value() && peek().value().type == type) {
+    constexpr const Token& try_consume(TokenType type, const char* err_msg) {
+        if (peek_is(type)) {
             return consume();
         } else {
-            std::cerr << err_msg << std::endl;
-            exit(EXIT_FAILURE);
+            front_end_error(err_msg);
         }
     }
-    inline std::optional<Token> try_consume(TokenType type) {
-        if (peek().has_value() && peek().value().type == type) {
-            return consume();
+    constexpr const Token* try_consume(TokenType type) {
+        if (peek_is(type)) {
+            return &consume();
         } else {
-            return {};
+            return nullptr;
         }
     }
 
     // advance to next token
-    inline Token consume() {
-        return m_tokens.at(m_index++);
+    constexpr const Token& consume() {
+        return m_tokens[m_index++];
     }
 
+    // tokens a streaming parser keeps lexed ahead, and the furthest it ever peeks (`let x =` and one more)
+    static constexpr size_t stream_window = 4096;
+    static constexpr size_t max_lookahead = 4;
+
     // memeber vars
-    const std::vector<Token> m_tokens; // stream of all tokens (sequential)
+    std::vector<Token> m_tokens; // stream of all tokens (sequential), or a window of it when streaming
     size_t m_index = 0; // pointer for current position in tokens vector
-    ArenaAllocator m_allocator;
+    Tokenizer* m_lexer = nullptr; // refills the window when streaming
+    size_t m_window = 0; // tokens lexed per refill, when streaming
+    size_t m_token_count = 0; // tokens consumed before the window
+    size_t m_node_count = 0; // nodes of the statements before the current one, when streaming
+    NodeProgram m_prog; // program being built
+    std::vector<uint32_t> m_operands; // expression nodes waiting for an operator, reused across expressions
+    std::vector<std::pair<NodeKind, int>> m_operators; // operators waiting for their rhs, with precedence
 };
@@ -0,0 +1,282 @@
+// Contains the optimization passes that run over the IR and the pass manager that schedules them
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <string_view>
+#include <chrono>
+#include <optional>
+#include <cstdint>
+
+#include "ir.hpp"
+
+// optimization levels selectable from the command line
+enum class OptLevel {
+    O0, // stack machine: every value is pushed and popped through the hardware stack
+    O1, // values are lowered to IR and kept in registers by the linear scan allocator, copies and dead lets removed
+    O2, // O1 plus constant folding / propagation and common subexpression elimination
+};
+
+// rewrites every operand through `repl` (vreg -> vreg standing in for it) and drops instructions marked dead
+inline void ir_rewrite(IrProgram& ir, const std::vector<uint32_t>& repl, const std::vector<bool>& dead) {
+    size_t out = 0;
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        if (dead[i]) {
+            continue;
+        }
+        IrInstr instr = ir.instrs[i];
+        if (instr.lhs != no_vreg) {
+            instr.lhs = repl[instr.lhs];
+        }
+        if (instr.rhs != no_vreg) {
+            instr.rhs = repl[instr.rhs];
+        }
+        ir.instrs[out++] = instr;
+    }
+    ir.instrs.resize(out);
+}
+
+// makes a vreg -> vreg map where every vreg stands for itself
+[[nodiscard]] inline std::vector<uint32_t> ir_identity(const IrProgram& ir) {
+    std::vector<uint32_t> repl(ir.vreg_count);
+    for (uint32_t vreg = 0; vreg < ir.vreg_count; vreg++) {
+        repl[vreg] = vreg;
+    }
+    return repl;
+}
+
+// replaces `dst = copy src` by using src directly wherever dst was used
+inline void pass_copy_propagation(IrProgram& ir) {
+    std::vector<uint32_t> repl = ir_identity(ir);
+    std::vector<bool> dead(ir.instrs.size(), false);
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        const IrInstr& instr = ir.instrs[i];
+        if (instr.op == IrOp::copy) {
+            // operands are always defined earlier, so repl[lhs] is already final
+            repl[instr.dst] = repl[instr.lhs];
+            dead[i] = true;
+        }
+    }
+    ir_rewrite(ir, repl, dead);
+}
+
+// true for the binary arithmetic ops
+[[nodiscard]] inline constexpr bool is_bin_op(IrOp op) {
+    return op == IrOp::add || op == IrOp::sub || op == IrOp::mul || op == IrOp::div;
+}
+
+// evaluates a binary op on constants, wrapping around like the instructions do
+// divisions that trap at run time (by zero, INT64_MIN / -1) are not evaluated and stay in the program
+[[nodiscard]] inline std::optional<int64_t> ir_eval(IrOp op, int64_t lhs, int64_t rhs) {
+    const auto a = static_cast<uint64_t>(lhs);
+    const auto b = static_cast<uint64_t>(rhs);
+    switch (op) {
+        case IrOp::add:
+            return static_cast<int64_t>(a + b);
+        case IrOp::sub:
+            return static_cast<int64_t>(a - b);
+        case IrOp::mul:
+            return static_cast<int64_t>(a * b);
+        case IrOp::div:
+            if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) {
+                return {};
+            }
+            return lhs / rhs;
+        default:
+            return {};
+    }
+}
+
+// evaluates arithmetic on known constants at compile time and simplifies `x + 0`, `x - 0`, `x * 1` and `x / 1`
+// constants flow through copies and the folded results, so whole chains of lets collapse into one imm
+inline void pass_constant_folding(IrProgram& ir) {
+    std::vector<std::optional<int64_t>> value(ir.vreg_count);
+    std::vector<uint32_t> repl = ir_identity(ir);
+    std::vector<bool> dead(ir.instrs.size(), false);
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        IrInstr& instr = ir.instrs[i];
+        if (instr.lhs != no_vreg) {
+            instr.lhs = repl[instr.lhs];
+        }
+        if (instr.rhs != no_vreg) {
+            instr.rhs = repl[instr.rhs];
+        }
+        switch (instr.op) {
+            case IrOp::imm:
+                value[instr.dst] = instr.imm;
+                break;
+            case IrOp::copy:
+                if (value[instr.lhs].has_value()) {
+                    instr = {.op = IrOp::imm, .dst = instr.dst, .imm = *value[instr.lhs]};
+                    value[instr.dst] = instr.imm;
+                }
+                break;
+            case IrOp::add:
+            case IrOp::sub:
+            case IrOp::mul:
+            case IrOp::div: {
+                const auto& lhs = value[instr.lhs];
+                const auto& rhs = value[instr.rhs];
+                // the identity element of the op, on the rhs for all of them and on the lhs for the commutative ones
+                const int64_t identity = instr.op == IrOp::add || instr.op == IrOp::sub ? 0 : 1;
+                const bool commutes = instr.op == IrOp::add || instr.op == IrOp::mul;
+                if (lhs.has_value() && rhs.has_value()) {
+                    if (auto result = ir_eval(instr.op, *lhs, *rhs)) {
+                        instr = {.op = IrOp::imm, .dst = instr.dst, .imm = *result};
+                        value[instr.dst] = *result;
+                    }
+                } else if (rhs == identity) {
+                    repl[instr.dst] = repl[instr.lhs];
+                    dead[i] = true;
+                } else if (commutes && lhs == identity) {
+                    repl[instr.dst] = repl[instr.rhs];
+                    dead[i] = true;
+                }
+                break;
+            }
+            case IrOp::exit:
+                break;
+        }
+    }
+    ir_rewrite(ir, repl, dead);
+}
+
+// reuses the result of an earlier identical computation (same op, same operands, same immediate)
+inline void pass_cse(IrProgram& ir) {
+    struct Key {
+        IrOp op;
+        uint32_t lhs;
+        uint32_t rhs;
+        int64_t imm;
+        bool operator==(const Key& other) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = static_cast<uint64_t>(key.op);
+            h = h * 0x9E3779B97F4A7C15ull ^ key.lhs;
+            h = h * 0x9E3779B97F4A7C15ull ^ key.rhs;
+            h = h * 0x9E3779B97F4A7C15ull ^ static_cast<uint64_t>(key.imm);
+            return static_cast<size_t>(h ^ (h >> 29));
+        }
+    };
+
+    std::unordered_map<Key, uint32_t, KeyHash> available;
+    std::vector<uint32_t> repl = ir_identity(ir);
+    std::vector<bool> dead(ir.instrs.size(), false);
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        IrInstr& instr = ir.instrs[i];
+        if (instr.lhs != no_vreg) {
+            instr.lhs = repl[instr.lhs];
+        }
+        if (instr.rhs != no_vreg) {
+            instr.rhs = repl[instr.rhs];
+        }
+        if (instr.op != IrOp::imm && !is_bin_op(instr.op)) {
+            continue;
+        }
+        Key key {.op = instr.op, .lhs = instr.lhs, .rhs = instr.rhs, .imm = instr.imm};
+        if ((instr.op == IrOp::add || instr.op == IrOp::mul) && key.lhs > key.rhs) {
+            std::swap(key.lhs, key.rhs); // a + b and b + a are the same value
+        }
+        auto [it, inserted] = available.try_emplace(key, instr.dst);
+        if (!inserted) {
+            repl[instr.dst] = it->second;
+            dead[i] = true;
+        }
+    }
+    ir_rewrite(ir, repl, dead);
+}
+
+// removes everything after the first exit and every instruction whose result is never used (dead lets)
+// a division whose result is unused still has to trap where the program would, it is only removed when its divisor
+// is a constant other than 0 and -1
+inline void pass_dead_code_elimination(IrProgram& ir) {
+    for (size_t i = 0; i < ir.instrs.size(); i++) {
+        if (ir.instrs[i].op == IrOp::exit) {
+            ir.instrs.resize(i + 1);
+            break;
+        }
+    }
+
+    // divisors that cannot trap: vregs holding a constant other than 0 and -1
+    std::vector<bool> safe_divisor(ir.vreg_count, false);
+    for (const IrInstr& instr : ir.instrs) {
+        if (instr.op == IrOp::imm) {
+            safe_divisor[instr.dst] = instr.imm != 0 && instr.imm != -1;
+        }
+    }
+
+    // walk backwards so a dead instruction never keeps its operands alive
+    std::vector<bool> used(ir.vreg_count, false);
+    std::vector<bool> dead(ir.instrs.size(), false);
+    for (size_t i = ir.instrs.size(); i-- > 0;) {
+        const IrInstr& instr = ir.instrs[i];
+        const bool may_trap = instr.op == IrOp::div && !safe_divisor[instr.rhs];
+        if (instr.dst != no_vreg && !used[instr.dst] && !may_trap) {
+            dead[i] = true;
+            continue;
+        }
+        if (instr.lhs != no_vreg) {
+            used[instr.lhs] = true;
+        }
+        if (instr.rhs != no_vreg) {
+            used[instr.rhs] = true;
+        }
+    }
+    ir_rewrite(ir, ir_identity(ir), dead);
+}
+
+// how long a pass took and what it did to the size of the program
+struct PassTiming {
+    std::string_view name;
+    double ms;
+    size_t instrs_before;
+    size_t instrs_after;
+};
+
+// runs the passes enabled for an optimization level in order and times each of them
+class PassManager {
+public:
+    struct Pass {
+        std::string_view name;
+        void (*run)(IrProgram&);
+    };
+
+    inline explicit PassManager(OptLevel opt_level) {
+        if (opt_level >= OptLevel::O2) {
+            m_passes.push_back({"constant-folding", pass_constant_folding});
+            m_passes.push_back({"cse", pass_cse});
+        }
+        if (opt_level >= OptLevel::O1) {
+            m_passes.push_back({"copy-propagation", pass_copy_propagation});
+            m_passes.push_back({"dead-code-elimination", pass_dead_code_elimination});
+        }
+    }
+
+    void run(IrProgram& ir) {
+        for (const Pass& pass : m_passes) {
+            const size_t before = ir.instrs.size();
+            const auto start = std::chrono::steady_clock::now();
+            pass.run(ir);
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            m_timings.push_back({.name = pass.name, .ms = elapsed.count(), .instrs_before = before, .instrs_after = ir.instrs.size()});
+        }
+    }
+
+    [[nodiscard]] inline const std::vector<PassTiming>& timings() const {
+        return m_timings;
+    }
+
+    // prints one line per pass that has run
+    void report(std::ostream& out) const {
+        for (const PassTiming& timing : m_timings) {
+            out << "pass " << timing.name << ": " << timing.ms << " ms, "
+                << timing.instrs_before << " -> " << timing.instrs_after << " instrs" << std::endl;
+        }
+    }
+
+private:
+    std::vector<Pass> m_passes;
+    std::vector<PassTiming> m_timings;
+};
@@ -0,0 +1,462 @@
+// Contains the peephole optimizer that rewrites short windows of the emitted instruction stream
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <span>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "x86.hpp"
+
+[[nodiscard]] inline constexpr uint32_t reg_bit(Reg reg) {
+    return 1u << static_cast<int>(reg);
+}
+
+// the registers a memory operand computes its address from
+[[nodiscard]] inline constexpr uint32_t address_regs(const Operand& operand) {
+    return reg_bit(operand.reg) | (operand.has_index() ? reg_bit(operand.index) : 0);
+}
+
+// the registers and memory an instruction touches, implicit operands included (rsp for push / pop, rax and rdx for
+// cqo / idiv, the argument registers for syscall). the base register of a memory operand counts as read
+struct InstrEffects {
+    uint32_t reads = 0; // one bit per Reg
+    uint32_t writes = 0;
+    bool reads_mem = false;
+    bool writes_mem = false;
+};
+
+// what an opcode does with its first operand, and the registers and memory it touches implicitly
+struct OpEffects {
+    bool reads_dst;
+    bool writes_dst;
+    uint32_t reads;
+    uint32_t writes;
+    bool reads_mem;
+    bool writes_mem;
+};
+
+// indexed by Op
+inline constexpr OpEffects op_effects[op_count] = {
+    // mov, lea
+    {.reads_dst = false, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = false, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    // push
+    {.reads_dst = true, .writes_dst = false, .reads = reg_bit(Reg::rsp), .writes = reg_bit(Reg::rsp),
+     .reads_mem = false, .writes_mem = true},
+    // pop
+    {.reads_dst = false, .writes_dst = true, .reads = reg_bit(Reg::rsp), .writes = reg_bit(Reg::rsp),
+     .reads_mem = true, .writes_mem = false},
+    // add, sub, imul
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    // imul_wide
+    {.reads_dst = true, .writes_dst = false, .reads = reg_bit(Reg::rax), .writes = reg_bit(Reg::rax) | reg_bit(Reg::rdx),
+     .reads_mem = false, .writes_mem = false},
+    // neg, shl, shr, sar
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    {.reads_dst = true, .writes_dst = true, .reads = 0, .writes = 0, .reads_mem = false, .writes_mem = false},
+    // cqo
+    {.reads_dst = false, .writes_dst = false, .reads = reg_bit(Reg::rax), .writes = reg_bit(Reg::rdx),
+     .reads_mem = false, .writes_mem = false},
+    // idiv
+    {.reads_dst = true, .writes_dst = false, .reads = reg_bit(Reg::rax) | reg_bit(Reg::rdx),
+     .writes = reg_bit(Reg::rax) | reg_bit(Reg::rdx), .reads_mem = false, .writes_mem = false},
+    // syscall: the number and the six arguments in, rax, rcx and r11 clobbered
+    {.reads_dst = false, .writes_dst = false,
+     .reads = reg_bit(Reg::rax) | reg_bit(Reg::rdi) | reg_bit(Reg::rsi) | reg_bit(Reg::rdx) | reg_bit(Reg::r10)
+         | reg_bit(Reg::r8) | reg_bit(Reg::r9),
+     .writes = reg_bit(Reg::rax) | reg_bit(Reg::rcx) | reg_bit(Reg::r11), .reads_mem = true, .writes_mem = true},
+    // ret: the caller sees every register
+    {.reads_dst = false, .writes_dst = false, .reads = (1u << reg_count) - 1, .writes = reg_bit(Reg::rsp),
+     .reads_mem = true, .writes_mem = false},
+};
+
+[[nodiscard]] inline InstrEffects instr_effects(const Instr& instr) {
+    const OpEffects& op = op_effects[static_cast<int>(instr.op)];
+    InstrEffects fx {.reads = op.reads, .writes = op.writes, .reads_mem = op.reads_mem, .writes_mem = op.writes_mem};
+    if (instr.dst.is_mem()) {
+        fx.reads |= address_regs(instr.dst);
+        fx.reads_mem |= op.reads_dst;
+        fx.writes_mem |= op.writes_dst;
+    } else if (instr.dst.is_reg()) {
+        fx.reads |= op.reads_dst ? reg_bit(instr.dst.reg) : 0;
+        fx.writes |= op.writes_dst ? reg_bit(instr.dst.reg) : 0;
+    }
+    // the second operand is only ever read
+    if (instr.src.is_reg()) {
+        fx.reads |= reg_bit(instr.src.reg);
+    } else if (instr.src.is_mem()) {
+        // lea only computes the address, it is counted as a memory read all the same
+        fx.reads |= address_regs(instr.src);
+        fx.reads_mem = true;
+    }
+    return fx;
+}
+
+// the instructions from the current position to the end of the buffer
+// a rule that matches at code[0] appends its replacement to `out` and returns how many instructions it consumed,
+// 0 if it does not apply. a replacement is never longer than what it consumed
+// a rule may also change one instruction further ahead that it does not consume, it sets `rewritten` to its index
+struct PeepholeWindow {
+    std::span<Instr> code;
+    bool at_end = false; // nothing runs after the last instruction of `code`
+    std::vector<Instr> out;
+    size_t rewritten = 0;
+};
+
+using PeepholeRule = size_t (*)(PeepholeWindow& window);
+
+// how far rules look ahead for a use of a register and then for its death
+inline constexpr size_t peephole_scan_limit = 8;
+
+// true if the value in `reg` after code[index] is never read: it is overwritten first, or the program ends
+// anything that is not settled within peephole_scan_limit instructions counts as read
+[[nodiscard]] inline bool reg_dead_after(const PeepholeWindow& window, size_t index, Reg reg) {
+    const size_t end = std::min(window.code.size(), index + 1 + peephole_scan_limit);
+    for (size_t i = index + 1; i < end; i++) {
+        const InstrEffects fx = instr_effects(window.code[i]);
+        if ((fx.reads & reg_bit(reg)) != 0) {
+            return false;
+        }
+        if ((fx.writes & reg_bit(reg)) != 0) {
+            return true;
+        }
+    }
+    return end == window.code.size() && window.at_end;
+}
+
+// push r / pop r
+inline size_t rule_push_pop_same(PeepholeWindow& window) {
+    if (window.code.size() < 2) {
+        return 0;
+    }
+    const Instr& push = window.code[0];
+    const Instr& pop = window.code[1];
+    if (push.op != Op::push || pop.op != Op::pop || !push.dst.is_reg() || push.dst != pop.dst) {
+        return 0;
+    }
+    return 2;
+}
+
+// push a / pop r -> mov r, a
+inline size_t rule_push_pop(PeepholeWindow& window) {
+    if (window.code.size() < 2) {
+        return 0;
+    }
+    const Instr& push = window.code[0];
+    const Instr& pop = window.code[1];
+    if (push.op != Op::push || pop.op != Op::pop || !pop.dst.is_reg() || pop.dst.reg == Reg::rsp) {
+        return 0;
+    }
+    if (push.dst.is_imm() && !fits_imm32(push.dst.imm)) {
+        return 0;
+    }
+    window.out.push_back({.op = Op::mov, .dst = pop.dst, .src = push.dst});
+    return 2;
+}
+
+// push a / x / pop r -> mov r, a / x, for an x that leaves r and the stack alone
+// this is the stack machine's `mov rax, imm` between pushing the lhs and popping it again. x may read the stack
+// above the pushed value, its offsets shrink by the slot that is no longer pushed, or the frame below rbp, which is
+// reserved by the prologue and so always lies above anything pushed
+inline size_t rule_push_pop_across(PeepholeWindow& window) {
+    if (window.code.size() < 3) {
+        return 0;
+    }
+    const Instr& push = window.code[0];
+    const Instr& pop = window.code[2];
+    if (push.op != Op::push || pop.op != Op::pop || !pop.dst.is_reg() || pop.dst.reg == Reg::rsp) {
+        return 0;
+    }
+    if (push.dst.is_imm() && !fits_imm32(push.dst.imm)) {
+        return 0;
+    }
+
+    Instr x = window.code[1];
+    const InstrEffects fx = instr_effects(x);
+    const uint32_t reg = reg_bit(pop.dst.reg);
+    if (((fx.reads | fx.writes) & reg) != 0 || (fx.writes & reg_bit(Reg::rsp)) != 0 || fx.writes_mem) {
+        return 0;
+    }
+    // rsp may only be read as the base of a memory operand that lies above the pushed slot
+    for (Operand* operand : {&x.dst, &x.src}) {
+        if (operand->is_reg() && operand->reg == Reg::rsp) {
+            return 0;
+        }
+        if (operand->is_mem() && !(operand->reg == Reg::rbp && !operand->has_index())) {
+            if (operand->reg != Reg::rsp || operand->disp < 8) {
+                return 0;
+            }
+            operand->disp -= 8;
+        }
+    }
+
+    window.out.push_back({.op = Op::mov, .dst = pop.dst, .src = push.dst});
+    window.out.push_back(x);
+    return 3;
+}
+
+// mov r, r
+inline size_t rule_mov_self(PeepholeWindow& window) {
+    const Instr& mov = window.code[0];
+    if (mov.op != Op::mov || !mov.dst.is_reg() || mov.dst != mov.src) {
+        return 0;
+    }
+    return 1;
+}
+
+// mov [m], r / mov d, [m] -> mov [m], r / mov d, r, nothing is loaded if d is r
+// a variable stored by a let and read right away by the next statement
+inline size_t rule_store_load(PeepholeWindow& window) {
+    if (window.code.size() < 2) {
+        return 0;
+    }
+    const Instr& store = window.code[0];
+    const Instr& load = window.code[1];
+    if (store.op != Op::mov || !store.dst.is_mem() || !store.src.is_reg() || load.op != Op::mov || !load.dst.is_reg()
+        || load.src != store.dst) {
+        return 0;
+    }
+    window.out.push_back(store);
+    if (load.dst != store.src) {
+        window.out.push_back({.op = Op::mov, .dst = load.dst, .src = store.src});
+    }
+    return 2;
+}
+
+// mov r, a / ... / op d, r -> ... / op d, a when r dies at the op and a is still the same value there
+// the operand of idiv and one operand imul is their first one, everything else reads r as its second
+inline size_t forward_into_use(PeepholeWindow& window, Operand::Kind kind) {
+    const Instr& def = window.code[0];
+    if (def.op != Op::mov || !def.dst.is_reg() || def.dst.reg == Reg::rsp || def.src.kind != kind) {
+        return 0;
+    }
+    const Reg reg = def.dst.reg;
+    const Operand value = def.src;
+
+    const size_t end = std::min(window.code.size(), 1 + peephole_scan_limit);
+    for (size_t i = 1; i < end; i++) {
+        Instr& use = window.code[i];
+        const InstrEffects fx = instr_effects(use);
+        if ((fx.reads & reg_bit(reg)) == 0) {
+            if ((fx.writes & reg_bit(reg)) != 0) {
+                return 0;
+            }
+            // a memory value has to be loaded before its base or the memory behind it changes
+            if (value.is_mem() && (fx.writes_mem || (fx.writes & address_regs(value)) != 0)) {
+                return 0;
+            }
+            continue;
+        }
+
+        Operand* operand = nullptr;
+        switch (use.op) {
+            case Op::mov:
+            case Op::add:
+            case Op::sub:
+            case Op::imul:
+                if (use.src == Operand::r(reg) && use.dst.is_reg() && use.dst.reg != reg) {
+                    operand = &use.src;
+                }
+                break;
+            case Op::imul_wide:
+            case Op::idiv:
+                if (use.dst == Operand::r(reg) && value.is_mem() && reg != Reg::rax && reg != Reg::rdx) {
+                    operand = &use.dst;
+                }
+                break;
+            default:
+                break;
+        }
+        if (operand == nullptr || !reg_dead_after(window, i, reg)) {
+            return 0;
+        }
+        // only mov takes a full 64 bit immediate
+        if (value.is_imm() && use.op != Op::mov && !fits_imm32(value.imm)) {
+            return 0;
+        }
+        *operand = value;
+        window.rewritten = i;
+        return 1;
+    }
+    return 0;
+}
+
+// mov r, imm / ... / add d, r -> ... / add d, imm
+inline size_t rule_forward_imm(PeepholeWindow& window) {
+    return forward_into_use(window, Operand::Kind::imm);
+}
+
+// mov r, [m] / ... / add d, r -> ... / add d, [m]
+inline size_t rule_fold_load(PeepholeWindow& window) {
+    return forward_into_use(window, Operand::Kind::mem);
+}
+
+// runs a table of rewrite rules over instruction buffers and counts how often each one fired
+// every rule preserves what the code computes, so the optimizer can run at any optimization level
+class Peephole {
+public:
+    struct Rule {
+        std::string_view name;
+        Op op; // the rule is only tried at instructions with this opcode
+        PeepholeRule apply;
+        bool enabled = true;
+        size_t fired = 0;
+    };
+
+    // instructions a rule may need to see after its first one, a buffer that more code follows keeps this many
+    // back so they can still be matched together with what comes next
+    static constexpr size_t lookahead = 2 * peephole_scan_limit + 2;
+
+    inline Peephole()
+        : m_rules {
+            {.name = "push-pop-same", .op = Op::push, .apply = rule_push_pop_same},
+            {.name = "push-pop", .op = Op::push, .apply = rule_push_pop},
+            {.name = "push-pop-across", .op = Op::push, .apply = rule_push_pop_across},
+            {.name = "mov-self", .op = Op::mov, .apply = rule_mov_self},
+            {.name = "store-load", .op = Op::mov, .apply = rule_store_load},
+            {.name = "forward-imm", .op = Op::mov, .apply = rule_forward_imm},
+            {.name = "fold-load", .op = Op::mov, .apply = rule_fold_load},
+        }
+    {
+    }
+
+    // returns false if there is no rule called `name`
+    bool disable(std::string_view name) {
+        for (Rule& rule : m_rules) {
+            if (rule.name == name) {
+                rule.enabled = false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void disable_all() {
+        for (Rule& rule : m_rules) {
+            rule.enabled = false;
+        }
+    }
+
+    [[nodiscard]] inline bool enabled() const {
+        for (const Rule& rule : m_rules) {
+            if (rule.enabled) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // rewrites `code` in place. `at_end` says the program ends with the buffer, otherwise registers still in use
+    // at its end are treated as live
+    // the buffer is walked backwards in one pass: code[begin, size) is already optimized, so every rule sees the
+    // final form of what follows it and a rewrite that enables another one (the stack machine's nested push / pop
+    // pairs) is found right away instead of on another pass
+    void run(std::vector<Instr>& code, bool at_end) {
+        if (!enabled()) {
+            return;
+        }
+        m_window.at_end = at_end;
+        size_t begin = code.size();
+        for (size_t index = code.size(); index-- > 0;) {
+            code[--begin] = code[index];
+            settle_all(code, begin, begin);
+        }
+        code.erase(code.begin(), code.begin() + static_cast<std::ptrdiff_t>(begin));
+    }
+
+    [[nodiscard]] inline const std::vector<Rule>& rules() const {
+        return m_rules;
+    }
+
+    // adds how often the rules of `other`, a copy of this optimizer that ran on a piece of the same program, fired
+    void add_counts(const Peephole& other) {
+        for (size_t i = 0; i < m_rules.size(); i++) {
+            m_rules[i].fired += other.m_rules[i].fired;
+        }
+    }
+
+    inline void clear_counts() {
+        for (Rule& rule : m_rules) {
+            rule.fired = 0;
+        }
+    }
+
+    // prints how often every enabled rule fired
+    void report(std::ostream& out) const {
+        for (const Rule& rule : m_rules) {
+            if (rule.enabled) {
+                out << "peephole " << rule.name << ": " << rule.fired << std::endl;
+            }
+        }
+    }
+
+private:
+    // settles code[pos], then every instruction a rule rewrote further ahead, which may match a rule of its own now
+    // removing instructions moves code[begin, pos) up, callers track their positions through `begin`
+    void settle_all(std::vector<Instr>& code, size_t& begin, size_t pos) {
+        size_t next = settle(code, begin, pos);
+        while (next < code.size()) {
+            next = settle(code, begin, next);
+        }
+    }
+
+    // applies rules at code[pos] until none matches. what a rule consumes is replaced in place and code[begin, pos)
+    // moves up to close the gap. returns the index of an instruction a rule rewrote ahead of pos, or code.size()
+    size_t settle(std::vector<Instr>& code, size_t& begin, size_t pos) {
+        size_t rewritten = code.size();
+        while (pos < code.size()) {
+            m_window.code = std::span(code).subspan(pos);
+            m_window.rewritten = 0;
+            const size_t consumed = apply_rules(m_window);
+            if (consumed == 0) {
+                break;
+            }
+            if (m_window.rewritten != 0) {
+                rewritten = pos + m_window.rewritten;
+            }
+            const size_t replaced = m_window.out.size();
+            const size_t gap = consumed - replaced;
+            std::copy(m_window.out.begin(), m_window.out.end(), code.begin() + static_cast<std::ptrdiff_t>(pos + gap));
+            m_window.out.clear();
+            if (gap > 0) {
+                std::copy_backward(code.begin() + static_cast<std::ptrdiff_t>(begin), code.begin() + static_cast<std::ptrdiff_t>(pos),
+                                   code.begin() + static_cast<std::ptrdiff_t>(pos + gap));
+                begin += gap;
+                pos += gap;
+            }
+            // the replacement is new code too, its later instructions are settled first like the rest of the buffer
+            for (size_t i = replaced; i-- > 1;) {
+                const size_t before = begin;
+                settle_all(code, begin, pos + i);
+                pos += begin - before;
+            }
+        }
+        return rewritten;
+    }
+
+    // tries the rules at window.code[0] in table order, the first that matches wins
+    size_t apply_rules(PeepholeWindow& window) {
+        const Op op = window.code[0].op;
+        for (Rule& rule : m_rules) {
+            if (rule.op != op || !rule.enabled) {
+                continue;
+            }
+            if (const size_t consumed = rule.apply(window); consumed > 0) {
+                rule.fired++;
+                return consumed;
+            }
+        }
+        return 0;
+    }
+
+    // member vars
+    std::vector<Rule> m_rules;
+    PeepholeWindow m_window; // reused so the replacement buffer is only allocated once
+};
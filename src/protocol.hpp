@@ -0,0 +1,151 @@
+// Contains the wire protocol between clear_client and `clear --server`: one request per connection carrying the
+// client's working directory, arguments, stdout and stderr, answered with the exit status of the compile
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// requests bigger than this are refused, argv of a compiler invocation is a few hundred bytes
+inline constexpr uint32_t max_request_size = 1024 * 1024; // 1mb
+
+// the directory of the socket when there is no $XDG_RUNTIME_DIR, only its owner may enter it (see
+// CompileServer::listen_on_socket), so nobody else can put a socket where clients look for the server
+[[nodiscard]] inline std::string fallback_socket_dir() {
+    return "/tmp/clear-" + std::to_string(getuid());
+}
+
+// $CLEAR_SOCKET, otherwise clear.sock in $XDG_RUNTIME_DIR, otherwise in fallback_socket_dir
+[[nodiscard]] inline std::string default_socket_path() {
+    if (const char* path = getenv("CLEAR_SOCKET"); path != nullptr && path[0] != '\0') {
+        return path;
+    }
+    if (const char* dir = getenv("XDG_RUNTIME_DIR"); dir != nullptr && dir[0] != '\0') {
+        return std::string(dir) + "/clear.sock";
+    }
+    return fallback_socket_dir() + "/clear.sock";
+}
+
+// true if the process at the other end of the connected unix socket `sock` runs as our user
+// the client hands the server its stdout, stderr and working directory and the server writes files as the client,
+// neither side talks to a peer of another user
+[[nodiscard]] inline bool peer_is_same_user(int sock) {
+    ucred cred {};
+    socklen_t size = sizeof(cred);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &size) == 0 && size == sizeof(cred)
+        && cred.uid == getuid();
+}
+
+// fills `addr` for `path`, false if the path is too long for a unix socket
+[[nodiscard]] inline bool socket_address(std::string_view path, sockaddr_un& addr) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+// write / read exactly `size` bytes, retrying short transfers and EINTR
+[[nodiscard]] inline bool write_exact(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+[[nodiscard]] inline bool read_exact(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        const ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// a request is the payload size as a uint32 followed by the payload: the working directory and then every argument,
+// each NUL terminated. the client's stdout and stderr travel with the size as SCM_RIGHTS, so the compile writes its
+// diagnostics straight to the client's terminal or pipe
+[[nodiscard]] inline bool send_request(int sock, std::string_view payload, int out_fd, int err_fd) {
+    const auto size = static_cast<uint32_t>(payload.size());
+    iovec iov {.iov_base = const_cast<uint32_t*>(&size), .iov_len = sizeof(size)};
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    const int fds[2] = {out_fd, err_fd};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == static_cast<ssize_t>(sizeof(size)) && write_exact(sock, payload.data(), payload.size());
+}
+
+// the other end of send_request, `out_fd` and `err_fd` are owned by the caller afterwards if it returned true
+[[nodiscard]] inline bool recv_request(int sock, std::string& payload, int& out_fd, int& err_fd) {
+    uint32_t size = 0;
+    iovec iov {.iov_base = &size, .iov_len = sizeof(size)};
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    const cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        return false;
+    }
+    int fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (received != static_cast<ssize_t>(sizeof(size)) || size > max_request_size) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    payload.resize(size);
+    if (!read_exact(sock, payload.data(), size)) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    out_fd = fds[0];
+    err_fd = fds[1];
+    return true;
+}
@@ -0,0 +1,233 @@
+// Contains the linear scan register allocator used by the optimizing backend
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+#include "ir.hpp"
+#include "x86.hpp"
+
+// where a vreg lives for its whole lifetime
+struct Location {
+    enum class Kind : uint8_t {
+        reg, // a register
+        slot, // a fixed frame slot at [rbp - 8 * (slot + 1)]
+        imm, // a constant that is rematerialized as an immediate operand wherever it is used
+    };
+
+    Kind kind;
+    Reg reg = Reg::rax;
+    uint32_t slot = 0;
+    int64_t imm = 0;
+
+    static constexpr Location in_reg(Reg reg) {
+        return {.kind = Kind::reg, .reg = reg};
+    }
+    static constexpr Location in_slot(uint32_t slot) {
+        return {.kind = Kind::slot, .slot = slot};
+    }
+    static constexpr Location in_imm(int64_t imm) {
+        return {.kind = Kind::imm, .imm = imm};
+    }
+
+    [[nodiscard]] constexpr bool is_reg() const {
+        return kind == Kind::reg;
+    }
+    [[nodiscard]] constexpr bool is_mem() const {
+        return kind == Kind::slot;
+    }
+    [[nodiscard]] constexpr bool is_imm() const {
+        return kind == Kind::imm;
+    }
+
+    constexpr bool operator==(const Location& other) const {
+        if (kind != other.kind) {
+            return false;
+        }
+        switch (kind) {
+            case Kind::reg:
+                return reg == other.reg;
+            case Kind::slot:
+                return slot == other.slot;
+            default:
+                return imm == other.imm;
+        }
+    }
+};
+
+struct Allocation {
+    std::vector<Location> locations; // indexed by vreg
+    uint32_t frame_slots = 0; // number of 8 byte spill slots the frame needs
+    uint32_t spill_count = 0; // number of vregs that did not get a register
+    uint32_t remat_count = 0; // number of constants that needed neither a register nor a slot
+    uint32_t used_regs = 0; // bitmask (by register encoding) of every register handed out
+};
+
+// rax is kept out of the pool as the scratch register for operands that live in memory
+// caller-saved registers come first so callee-saved ones are only touched under pressure
+inline constexpr Reg allocatable_regs[] = {
+    Reg::rcx, Reg::rdx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10, Reg::r11,
+    Reg::rbx, Reg::r12, Reg::r13, Reg::r14, Reg::r15
+};
+inline constexpr uint32_t allocatable_reg_count = sizeof(allocatable_regs) / sizeof(allocatable_regs[0]);
+
+// classic linear scan (Poletto & Sarkar) over the live intervals of the vregs
+// since Clear programs are straight line code a live interval is just [definition, last use]
+// constants that fit a sign extended 32 bit immediate are never allocated, every use takes them as an operand
+// idiv divides rdx:rax, so values live across a division never get rdx. the only divisors left as immediates are
+// constants other than 0 and -1, the generator divides by those without idiv
+class LinearScan {
+public:
+    // `reg_limit` caps how many registers of the pool may be used
+    inline explicit LinearScan(const IrProgram& ir, uint32_t reg_limit = allocatable_reg_count)
+        : m_ir(ir),
+        m_reg_limit(std::min(reg_limit, allocatable_reg_count))
+    {
+    }
+
+    [[nodiscard]] Allocation run() {
+        compute_intervals();
+
+        Allocation alloc;
+        alloc.locations.resize(m_ir.vreg_count, Location::in_slot(0));
+
+        std::vector<bool> reg_free(m_reg_limit, true);
+        std::vector<uint32_t> free_slots;
+        // active intervals holding a register, kept sorted by increasing end
+        std::vector<uint32_t> active;
+        // active intervals holding a frame slot as (end, slot), earliest end on top
+        std::priority_queue<std::pair<uint32_t, uint32_t>, std::vector<std::pair<uint32_t, uint32_t>>, std::greater<>> active_slots;
+
+        auto by_end = [this](uint32_t a, uint32_t b) { return m_end[a] < m_end[b]; };
+        auto insert_sorted = [&](std::vector<uint32_t>& list, uint32_t vreg) {
+            list.insert(std::upper_bound(list.begin(), list.end(), vreg, by_end), vreg);
+        };
+        // `reuse` is only allowed for an interval that starts now, a slot on the free list may have been
+        // in use earlier in the lifetime of an interval that is spilled after the fact
+        auto assign_slot = [&](uint32_t vreg, bool reuse) {
+            uint32_t slot;
+            if (reuse && !free_slots.empty()) {
+                slot = free_slots.back();
+                free_slots.pop_back();
+            } else {
+                slot = alloc.frame_slots++;
+            }
+            alloc.locations[vreg] = Location::in_slot(slot);
+            alloc.spill_count++;
+            active_slots.push({m_end[vreg], slot});
+        };
+
+        // vregs are defined in increasing order, so iterating them visits intervals by increasing start
+        for (uint32_t vreg = 0; vreg < m_ir.vreg_count; vreg++) {
+            if (!m_defined[vreg]) {
+                continue; // removed by an optimization pass
+            }
+            if (m_remat[vreg]) {
+                alloc.locations[vreg] = Location::in_imm(m_imm[vreg]);
+                alloc.remat_count++;
+                continue;
+            }
+            const uint32_t start = m_start[vreg];
+
+            // expire intervals whose last use is at or before this definition, an operand's register
+            // can be reused for the result of the same instruction
+            size_t expired = 0;
+            while (expired < active.size() && m_end[active[expired]] <= start) {
+                reg_free[m_pool_index[active[expired]]] = true;
+                expired++;
+            }
+            active.erase(active.begin(), active.begin() + expired);
+            while (!active_slots.empty() && active_slots.top().first <= start) {
+                free_slots.push_back(active_slots.top().second);
+                active_slots.pop();
+            }
+
+            const bool avoid_rdx = crosses_div(vreg);
+            uint32_t index = 0;
+            while (index < m_reg_limit && (!reg_free[index] || (avoid_rdx && allocatable_regs[index] == Reg::rdx))) {
+                index++;
+            }
+
+            if (index == m_reg_limit) {
+                // no register left, spill whichever interval ends last
+                if (!active.empty() && m_end[active.back()] > m_end[vreg]
+                    && !(avoid_rdx && allocatable_regs[m_pool_index[active.back()]] == Reg::rdx)) {
+                    const uint32_t spill = active.back();
+                    m_pool_index[vreg] = m_pool_index[spill];
+                    alloc.locations[vreg] = alloc.locations[spill];
+                    active.pop_back();
+                    insert_sorted(active, vreg);
+                    assign_slot(spill, false);
+                } else {
+                    assign_slot(vreg, true);
+                }
+                continue;
+            }
+
+            reg_free[index] = false;
+            m_pool_index[vreg] = index;
+            alloc.locations[vreg] = Location::in_reg(allocatable_regs[index]);
+            alloc.used_regs |= 1u << static_cast<int>(allocatable_regs[index]);
+            insert_sorted(active, vreg);
+        }
+
+        return alloc;
+    }
+
+private:
+    // whether a division happens after the definition of `vreg` and while it is still live
+    [[nodiscard]] bool crosses_div(uint32_t vreg) const {
+        auto it = std::upper_bound(m_div_positions.begin(), m_div_positions.end(), m_start[vreg]);
+        return it != m_div_positions.end() && *it <= m_end[vreg];
+    }
+
+    // live interval of every vreg, as instruction indices
+    void compute_intervals() {
+        m_start.assign(m_ir.vreg_count, 0);
+        m_end.assign(m_ir.vreg_count, 0);
+        m_pool_index.assign(m_ir.vreg_count, 0);
+        m_defined.assign(m_ir.vreg_count, false);
+        m_remat.assign(m_ir.vreg_count, false);
+        m_imm.assign(m_ir.vreg_count, 0);
+        m_div_positions.clear();
+        for (uint32_t i = 0; i < m_ir.instrs.size(); i++) {
+            const IrInstr& instr = m_ir.instrs[i];
+            if (instr.op == IrOp::div) {
+                m_div_positions.push_back(i);
+                // idiv has no immediate form, a division by zero or INT64_MIN / -1 still has to reach it and trap
+                if (m_remat[instr.rhs] && (m_imm[instr.rhs] == 0 || m_imm[instr.rhs] == -1)) {
+                    m_remat[instr.rhs] = false;
+                }
+            }
+            if (instr.lhs != no_vreg) {
+                m_end[instr.lhs] = i;
+            }
+            if (instr.rhs != no_vreg) {
+                m_end[instr.rhs] = i;
+            }
+            if (instr.dst != no_vreg) {
+                m_defined[instr.dst] = true;
+                if (instr.op == IrOp::imm && instr.imm >= INT32_MIN && instr.imm <= INT32_MAX) {
+                    m_remat[instr.dst] = true;
+                    m_imm[instr.dst] = instr.imm;
+                }
+                m_start[instr.dst] = i;
+                m_end[instr.dst] = i; // a vreg that is never used dies where it is defined
+            }
+        }
+    }
+
+    // member vars
+    const IrProgram& m_ir;
+    uint32_t m_reg_limit;
+    std::vector<uint32_t> m_start;
+    std::vector<uint32_t> m_end;
+    std::vector<uint32_t> m_pool_index; // index into allocatable_regs of the register held by each vreg
+    std::vector<bool> m_defined;
+    std::vector<bool> m_remat; // vregs defined by a small enough imm
+    std::vector<int64_t> m_imm;
+    std::vector<uint32_t> m_div_positions; // indices of the div instructions, increasing
+};
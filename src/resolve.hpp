@@ -0,0 +1,55 @@
+// Contains name resolution, the pass between parsing and codegen that checks every variable reference
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "parser.hpp"
+#include "diagnostics.hpp"
+
+// checks that every variable is declared before it is used and declared only once
+// Clear has a single scope, so each symbol id names at most one variable and the backends can keep per variable
+// state in flat vectors indexed by symbol id without checking anything again
+// a program can be checked in parts that share their symbol ids, one statement at a time when streaming
+// (Parser::next_stmt), a part sees the variables the parts before it declared
+class NameResolver {
+public:
+    // checks the next part of the program, returns the number of variables it declares
+    constexpr size_t resolve(const NodeProgram& prog) {
+        m_declared.resize(std::max(m_declared.size(), prog.symbols.size()), false);
+        size_t var_count = 0;
+        // nodes are in postorder, so the initializer of a let is visited before the let declares its name
+        for (uint32_t index = 0; index < prog.node_count(); index++) {
+            switch (prog.kinds[index]) {
+                case NodeKind::ident: {
+                    const uint32_t symbol = prog.lhs[index];
+                    if (!m_declared[symbol]) {
+                        fatal_error("Variable '", prog.symbols[symbol], "' not declared");
+                    }
+                    break;
+                }
+                case NodeKind::stmt_let: {
+                    const uint32_t symbol = prog.rhs[index];
+                    if (m_declared[symbol]) {
+                        fatal_error("Identifier already used: ", prog.symbols[symbol]);
+                    }
+                    m_declared[symbol] = true;
+                    var_count++;
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        return var_count;
+    }
+
+private:
+    // member vars
+    std::vector<bool> m_declared; // symbol id -> declared by an earlier let
+};
+
+// checks a whole program, returns the number of variables
+inline constexpr size_t resolve_names(const NodeProgram& prog) {
+    return NameResolver().resolve(prog);
+}
@@ -0,0 +1,272 @@
+// Contains the compile server behind `clear --server`: a daemon on a unix socket that compiles the requests sent by
+// clear_client, so a build issuing many small compiles does not pay for starting the compiler on every one of them
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+
+// every request is compiled in a child forked from the server. the driver reports errors by exiting and writes its
+// outputs relative to the working directory, a child can do both without taking the server or other requests with
+// it, and it starts with everything the server already loaded and initialized. children run concurrently, the
+// server only accepts connections and sends each client the exit status of its child
+class CompileServer {
+public:
+    // compiles one request like `main` would, called in the child after it took over the client's working
+    // directory, stdout and stderr. argv[0] is "clear"
+    using CompileFn = int (*)(int argc, char* argv[]);
+
+    inline CompileServer(std::string socket_path, CompileFn compile)
+        : m_socket_path(std::move(socket_path)),
+        m_compile(compile)
+    {
+    }
+
+    inline CompileServer(const CompileServer& other) = delete;
+
+    inline CompileServer& operator=(const CompileServer& other) = delete;
+
+    // serves until SIGINT, SIGTERM or SIGHUP, then waits for the compiles still running and removes the socket
+    int run() {
+        listen_on_socket();
+        block_signals();
+        std::cerr << "clear server listening on " << m_socket_path << std::endl;
+
+        bool stopping = false;
+        while (!stopping) {
+            pollfd fds[2] = {{.fd = m_listen_fd, .events = POLLIN, .revents = 0}, {.fd = m_signal_fd, .events = POLLIN, .revents = 0}};
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Unable to poll: " << strerror(errno) << std::endl;
+                break;
+            }
+            if ((fds[1].revents & POLLIN) != 0) {
+                stopping = handle_signals();
+            }
+            if (!stopping && (fds[0].revents & POLLIN) != 0) {
+                accept_client();
+            }
+        }
+
+        close(m_listen_fd);
+        unlink(m_socket_path.c_str());
+        while (!m_clients.empty()) {
+            int status = 0;
+            const pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0 && errno != EINTR) {
+                break;
+            }
+            finish(pid, status);
+        }
+        close(m_signal_fd);
+        return EXIT_SUCCESS;
+    }
+
+private:
+    // a client that does not send its request within this time is dropped. the request is read in the child, so a
+    // slow client only holds up its own compile
+    static constexpr int request_timeout_ms = 1000;
+
+    void listen_on_socket() {
+        sockaddr_un addr {};
+        if (!socket_address(m_socket_path, addr)) {
+            std::cerr << "Socket path too long: " << m_socket_path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (m_socket_path == default_socket_path() && m_socket_path.starts_with(fallback_socket_dir() + "/")) {
+            make_private_dir(fallback_socket_dir());
+        }
+        m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listen_fd < 0) {
+            std::cerr << "Unable to create socket: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        // a socket file nobody accepts on is left over from a server that died, it is replaced
+        if (connect(m_listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0) {
+            std::cerr << "A clear server is already listening on " << m_socket_path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        close(m_listen_fd);
+        unlink(m_socket_path.c_str());
+
+        // the socket is created accessible to its owner only, whatever the umask was
+        m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const mode_t old_umask = umask(077);
+        const bool bound = m_listen_fd >= 0 && bind(m_listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+        umask(old_umask);
+        if (!bound || listen(m_listen_fd, SOMAXCONN) < 0) {
+            std::cerr << "Unable to listen on " << m_socket_path << ": " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // creates `dir` with mode 0700, or checks that it already is a directory of ours that nobody else can enter
+    // /tmp is shared, another user may have created the directory (or a symlink) first
+    static void make_private_dir(const std::string& dir) {
+        if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST) {
+            std::cerr << "Unable to create " << dir << ": " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        struct stat st {};
+        if (lstat(dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+            std::cerr << dir << " is not a directory only we can access, refusing to put the socket there" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the signals the server reacts to are read from a signalfd, so poll wakes up for them like for a connection
+    void block_signals() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGHUP);
+        sigprocmask(SIG_BLOCK, &set, &m_old_mask);
+        // a client that went away must not take the server down when its exit status is sent
+        signal(SIGPIPE, SIG_IGN);
+        m_signal_fd = signalfd(-1, &set, SFD_CLOEXEC);
+        if (m_signal_fd < 0) {
+            std::cerr << "Unable to create signalfd: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // reaps finished children, true if the server was asked to stop
+    bool handle_signals() {
+        bool stop = false;
+        signalfd_siginfo info {};
+        while (read(m_signal_fd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+            if (info.ssi_signo != SIGCHLD) {
+                stop = true;
+            }
+            // signals of the same kind coalesce, one SIGCHLD can stand for several children
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                finish(pid, status);
+            }
+            // the signalfd is blocking, only read again if another signal is already queued
+            pollfd pending {.fd = m_signal_fd, .events = POLLIN, .revents = 0};
+            if (poll(&pending, 1, 0) <= 0) {
+                break;
+            }
+        }
+        return stop;
+    }
+
+    // forks the child that reads and compiles the request, the server never waits on a client
+    void accept_client() {
+        const int client = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            return;
+        }
+        if (!peer_is_same_user(client)) {
+            close(client);
+            return;
+        }
+
+        const pid_t pid = fork();
+        if (pid == 0) {
+            serve(client);
+        }
+        if (pid < 0) {
+            const int32_t status = EXIT_FAILURE;
+            (void)write_exact(client, &status, sizeof(status));
+            close(client);
+            return;
+        }
+        m_clients.emplace(pid, client);
+    }
+
+    // runs in the child: reads the request, takes over the client's stdout, stderr and working directory and
+    // compiles. the server sends the client the exit status
+    [[noreturn]] void serve(int client) {
+        sigprocmask(SIG_SETMASK, &m_old_mask, nullptr);
+        signal(SIGPIPE, SIG_DFL);
+        close(m_listen_fd);
+        close(m_signal_fd);
+        for (const auto& [other_pid, other_client] : m_clients) {
+            close(other_client);
+        }
+
+        const timeval timeout {.tv_sec = request_timeout_ms / 1000, .tv_usec = request_timeout_ms % 1000 * 1000};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string payload;
+        int out_fd = -1;
+        int err_fd = -1;
+        const bool received = recv_request(client, payload, out_fd, err_fd);
+        close(client);
+        if (!received) {
+            exit(EXIT_FAILURE);
+        }
+        const int null_fd = open("/dev/null", O_RDONLY);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(err_fd, STDERR_FILENO);
+        close(null_fd);
+        close(out_fd);
+        close(err_fd);
+
+        // the payload is the working directory followed by the arguments, all NUL terminated
+        std::vector<std::string> parts;
+        for (size_t start = 0; start < payload.size();) {
+            const size_t end = payload.find('\0', start);
+            parts.emplace_back(payload.substr(start, end - start));
+            start = end == std::string::npos ? payload.size() : end + 1;
+        }
+        if (parts.empty() || chdir(parts[0].c_str()) < 0) {
+            std::cerr << "Unable to enter the client's working directory: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        parts[0] = "clear";
+        std::vector<char*> argv;
+        for (std::string& part : parts) {
+            argv.push_back(part.data());
+        }
+        argv.push_back(nullptr);
+        exit(m_compile(static_cast<int>(parts.size()), argv.data()));
+    }
+
+    // sends the exit status of child `pid` to its client, a child killed by a signal reports 128 + the signal like
+    // a shell does
+    void finish(pid_t pid, int status) {
+        const auto it = m_clients.find(pid);
+        if (it == m_clients.end()) {
+            return;
+        }
+        const int32_t code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        (void)write_exact(it->second, &code, sizeof(code));
+        close(it->second);
+        m_clients.erase(it);
+    }
+
+    // member vars
+    std::string m_socket_path;
+    CompileFn m_compile;
+    int m_listen_fd = -1;
+    int m_signal_fd = -1;
+    sigset_t m_old_mask {};
+    std::unordered_map<pid_t, int> m_clients; // running child -> connection of the client waiting for it
+};
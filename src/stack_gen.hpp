@@ -0,0 +1,235 @@
+// Contains the -O0 code generator, a stack machine that keeps every variable and intermediate value on the stack
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <vector>
+
+#include "parser.hpp"
+#include "x86.hpp"
+
+// returns the value in rax to the caller of JIT code: drops the frame and restores the callee-saved registers the
+// prologue pushed (`saved_regs`, in push order)
+inline void emit_return(std::vector<Instr>& code, std::span<const Reg> saved_regs) {
+    code.push_back({.op = Op::mov, .dst = Operand::r(Reg::rsp), .src = Operand::r(Reg::rbp)});
+    code.push_back({.op = Op::pop, .dst = Operand::r(Reg::rbp)});
+    for (auto it = saved_regs.rbegin(); it != saved_regs.rend(); it++) {
+        code.push_back({.op = Op::pop, .dst = Operand::r(*it)});
+    }
+    code.push_back({.op = Op::ret});
+}
+
+// a range of whole statements that is generated on its own
+struct StackPiece {
+    uint32_t first_node;
+    uint32_t end_node; // one past the root of its last statement
+};
+
+// the slot of every variable, and the program cut into pieces that can be generated independently
+// every variable gets a fixed slot in the frame below rbp, which the prologue reserves with a single sub rsp. slots
+// are shared by variables whose live ranges do not overlap, so a program with many short lived variables keeps
+// reusing a few slots instead of growing the stack by one for every let. the expressions push their operands below
+// the frame and leave nothing there between statements, so any range of whole statements can be generated on its own
+struct StackLayout {
+    std::vector<size_t> var_slots; // symbol id -> slot
+    size_t var_count = 0;
+    size_t frame_slots = 0; // slots below rbp, at most var_count
+    // false for a streamed program (add_var): its variables stay on the stack where their lets left them
+    bool frame = false;
+    std::vector<StackPiece> pieces; // in program order, at least one
+
+    // one linear pass over the nodes backwards, where a variable comes alive at its last use and dies at its let
+    // every piece ends with the first statement that brings it to `piece_nodes` nodes
+    [[nodiscard]] static StackLayout of(const NodeProgram& prog, size_t piece_nodes) {
+        StackLayout layout;
+        layout.frame = true;
+        layout.var_slots.assign(prog.symbols.size(), 0);
+        std::vector<bool> live(prog.symbols.size(), false);
+        std::vector<size_t> free_slots; // the most recently freed slot is taken first
+        const auto take_slot = [&](uint32_t symbol) {
+            if (free_slots.empty()) {
+                free_slots.push_back(layout.frame_slots++);
+            }
+            layout.var_slots[symbol] = free_slots.back();
+            free_slots.pop_back();
+        };
+        // the root of a let comes after the nodes of its initializer, so its slot is freed before the variables its
+        // initializer reads take theirs: the initializer is evaluated before the let stores, they may share a slot
+        for (uint32_t index = static_cast<uint32_t>(prog.node_count()); index-- > 0;) {
+            if (prog.kinds[index] == NodeKind::ident && !live[prog.lhs[index]]) {
+                live[prog.lhs[index]] = true;
+                take_slot(prog.lhs[index]);
+            } else if (prog.kinds[index] == NodeKind::stmt_let) {
+                const uint32_t symbol = prog.rhs[index];
+                // a variable that is never read is still stored, into any slot that is free at its let
+                if (!live[symbol]) {
+                    take_slot(symbol);
+                }
+                live[symbol] = false;
+                free_slots.push_back(layout.var_slots[symbol]);
+                layout.var_count++;
+            }
+        }
+
+        StackPiece piece {.first_node = 0, .end_node = 0};
+        for (uint32_t stmt : prog.stmts) {
+            piece.end_node = stmt + 1;
+            if (piece.end_node - piece.first_node >= piece_nodes) {
+                layout.pieces.push_back(piece);
+                piece = {.first_node = piece.end_node, .end_node = piece.end_node};
+            }
+        }
+        if (layout.pieces.empty() || piece.end_node > piece.first_node) {
+            layout.pieces.push_back(piece);
+        }
+        return layout;
+    }
+
+    // gives the variable a let declares the next stack slot, counted from the bottom, the layout of a streamed
+    // program is built this way one statement at a time. the live ranges are not known before the program ends,
+    // so nothing is shared: a let leaves the value of its expression on the stack as the variable, the n-th let of
+    // the program owns slot n and the stack is exactly as deep as the lets before a statement
+    void add_var(uint32_t symbol) {
+        if (symbol >= var_slots.size()) {
+            var_slots.resize(symbol + 1, 0);
+        }
+        var_slots[symbol] = var_count++;
+    }
+};
+
+// generates the stack machine code for a range of nodes of the flat AST
+// nothing but the depth of the stack is threaded from node to node, so any range of whole statements can be
+// generated on its own given the depth at its start (0 with a frame, the number of lets before it when streaming)
+class StackGen {
+public:
+    // code for the JIT is called as a function, so exit returns its value through emit_return instead of issuing the
+    // exit syscall
+    inline StackGen(const NodeProgram& prog, const StackLayout& layout, std::span<const Reg> saved_regs, bool returns,
+                    size_t stack_size)
+        : m_prog(prog),
+        m_layout(layout),
+        m_saved_regs(saved_regs),
+        m_returns(returns),
+        m_stack_size(stack_size)
+    {
+    }
+
+    // appends the code for nodes [first, end) to `code`
+    void gen_nodes(uint32_t first, uint32_t end, std::vector<Instr>& code) {
+        m_code = &code;
+        for (uint32_t index = first; index < end; index++) {
+            gen_node(index);
+        }
+        m_code = nullptr;
+    }
+
+    // deepest the stack got, in 8 byte slots
+    [[nodiscard]] inline size_t peak_stack_size() const {
+        return m_peak_stack_size;
+    }
+
+private:
+    // nodes are visited in index order, which is postorder, so an operation finds its operands on top of the stack
+    void gen_node(uint32_t index) {
+        switch (m_prog.kinds[index]) {
+            // integer literals are loaded and pushed
+            case NodeKind::int_lit:
+                emit(Op::mov, Operand::r(Reg::rax), Operand::i(m_prog.int_lits[m_prog.lhs[index]]));
+                push(Reg::rax);
+                break;
+            case NodeKind::ident: {
+                const size_t stack_loc = m_layout.var_slots[m_prog.lhs[index]];
+
+                // copy the variable's value to the top of the stack
+                if (m_layout.frame) {
+                    emit(Op::push, frame_slot(stack_loc));
+                } else {
+                    emit(Op::push, Operand::m(Reg::rsp, static_cast<int32_t>((m_stack_size - stack_loc - 1) * 8)));
+                }
+                m_stack_size++;
+                m_peak_stack_size = std::max(m_peak_stack_size, m_stack_size);
+                break;
+            }
+            // handles binary expressions, both sides are already on the top of the stack
+            case NodeKind::add:
+                // retreive the values from the stack to perform addition
+                pop(Reg::rax);
+                pop(Reg::rbx);
+
+                // add command adds the values in the 2 registers and stores the result in the first register listed (rax)
+                emit(Op::add, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+                // push the evaluated value back onto the stack so it can be assigned to an identifier
+                push(Reg::rax);
+                break;
+            // the other operators are not commutative or need rax as their lhs, so the rhs (on top) goes to rbx
+            case NodeKind::sub:
+                pop(Reg::rbx);
+                pop(Reg::rax);
+                emit(Op::sub, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+                push(Reg::rax);
+                break;
+            case NodeKind::mul:
+                pop(Reg::rbx);
+                pop(Reg::rax);
+                emit(Op::imul, Operand::r(Reg::rax), Operand::r(Reg::rbx));
+                push(Reg::rax);
+                break;
+            case NodeKind::div:
+                pop(Reg::rbx);
+                pop(Reg::rax);
+                // idiv divides rdx:rax, so sign extend the dividend into rdx first. the quotient lands in rax
+                emit(Op::cqo);
+                emit(Op::idiv, Operand::r(Reg::rbx));
+                push(Reg::rax);
+                break;
+            // handle exit stmt
+            case NodeKind::stmt_exit:
+                if (m_returns) {
+                    pop(Reg::rax);
+                    emit_return(*m_code, m_saved_regs);
+                    break;
+                }
+                emit(Op::mov, Operand::r(Reg::rax), Operand::i(60));
+                pop(Reg::rdi);
+                emit(Op::syscall);
+                break;
+            // handle let stmt, the value of the expression goes to the variable's frame slot, or stays on the stack as
+            // the variable when streaming (see StackLayout)
+            case NodeKind::stmt_let:
+                if (m_layout.frame) {
+                    pop(Reg::rax);
+                    emit(Op::mov, frame_slot(m_layout.var_slots[m_prog.rhs[index]]), Operand::r(Reg::rax));
+                }
+                break;
+        }
+    }
+
+    [[nodiscard]] static Operand frame_slot(size_t slot) {
+        return Operand::m(Reg::rbp, -static_cast<int32_t>((slot + 1) * 8));
+    }
+
+    void emit(Op op, Operand dst = {}, Operand src = {}) {
+        m_code->push_back({.op = op, .dst = dst, .src = src});
+    }
+
+    // pushes a value from a given register and incriments stack size
+    void push(Reg reg) {
+        emit(Op::push, Operand::r(reg));
+        m_stack_size++;
+        m_peak_stack_size = std::max(m_peak_stack_size, m_stack_size);
+    }
+    // pops a value from a given register and decrements stack size
+    void pop(Reg reg) {
+        emit(Op::pop, Operand::r(reg));
+        m_stack_size--;
+    }
+
+    // member vars
+    const NodeProgram& m_prog;
+    const StackLayout& m_layout;
+    std::span<const Reg> m_saved_regs;
+    const bool m_returns;
+    std::vector<Instr>* m_code = nullptr; // where gen_nodes is appending to
+    size_t m_stack_size;
+    size_t m_peak_stack_size = 0;
+};
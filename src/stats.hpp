@@ -0,0 +1,135 @@
+// Contains the instrumentation behind --time-report / --stats: per phase wall time and allocations plus size counters
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+#include "tokenization.hpp"
+
+// heap allocations made by the whole process, counted by the replacement operator new in main.cpp
+inline std::atomic<uint64_t> g_alloc_count {0};
+inline std::atomic<uint64_t> g_alloc_bytes {0};
+
+struct PhaseStats {
+    std::string_view name;
+    double ms;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+};
+
+// collects what the driver measured and prints it once compilation is done
+class Stats {
+public:
+    // times a phase from construction to destruction and records it, along with the allocations made meanwhile
+    class Phase {
+    public:
+        inline Phase(Stats& stats, std::string_view name)
+            : m_stats(stats),
+            m_name(name),
+            m_allocs(g_alloc_count.load(std::memory_order_relaxed)),
+            m_alloc_bytes(g_alloc_bytes.load(std::memory_order_relaxed)),
+            m_start(std::chrono::steady_clock::now())
+        {
+        }
+
+        inline Phase(const Phase& other) = delete;
+
+        inline Phase& operator=(const Phase& other) = delete;
+
+        inline ~Phase() {
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_start;
+            m_stats.add_phase({
+                .name = m_name,
+                .ms = elapsed.count(),
+                .allocs = g_alloc_count.load(std::memory_order_relaxed) - m_allocs,
+                .alloc_bytes = g_alloc_bytes.load(std::memory_order_relaxed) - m_alloc_bytes,
+            });
+        }
+
+    private:
+        Stats& m_stats;
+        std::string_view m_name;
+        uint64_t m_allocs;
+        uint64_t m_alloc_bytes;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    inline void add_phase(const PhaseStats& phase) {
+        m_phases.push_back(phase);
+    }
+
+    // moves `ms` of an already recorded phase into a new one that is reported right after it,
+    // for work (like writing the output) that happens in small pieces inside another phase
+    inline void split_phase(std::string_view from, std::string_view name, double ms) {
+        for (size_t i = 0; i < m_phases.size(); i++) {
+            if (m_phases[i].name == from) {
+                m_phases[i].ms -= ms;
+                m_phases.insert(m_phases.begin() + static_cast<std::ptrdiff_t>(i) + 1, {.name = name, .ms = ms, .allocs = 0, .alloc_bytes = 0});
+                return;
+            }
+        }
+    }
+
+    // counters
+    size_t source_bytes = 0;
+    size_t tokens = 0;
+    size_t token_bytes_reserved = 0;
+    size_t ast_nodes = 0;
+    size_t ast_bytes_used = 0;
+    size_t ast_bytes_reserved = 0;
+    size_t vars = 0;
+    size_t peak_stack_size = 0; // in 8 byte slots
+    size_t output_bytes = 0;
+
+    void report_text(std::ostream& out) const {
+        double total_ms = 0;
+        uint64_t total_allocs = 0;
+        uint64_t total_bytes = 0;
+        out << "phase              time (ms)     allocs   alloc bytes" << std::endl;
+        for (const PhaseStats& phase : m_phases) {
+            out << std::left << std::setw(14) << phase.name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(14) << phase.ms << std::setw(11) << phase.allocs << std::setw(14) << phase.alloc_bytes << std::endl;
+            total_ms += phase.ms;
+            total_allocs += phase.allocs;
+            total_bytes += phase.alloc_bytes;
+        }
+        out << std::left << std::setw(14) << "total" << std::right
+            << std::setw(14) << total_ms << std::setw(11) << total_allocs << std::setw(14) << total_bytes << std::endl;
+        out << "source bytes:      " << source_bytes << std::endl;
+        out << "tokens:            " << tokens << " (" << tokens * sizeof(Token) << " bytes used, "
+            << token_bytes_reserved << " reserved)" << std::endl;
+        out << "ast nodes:         " << ast_nodes << " (" << ast_bytes_used << " bytes used, "
+            << ast_bytes_reserved << " reserved)" << std::endl;
+        out << "variables:         " << vars << std::endl;
+        out << "peak stack slots:  " << peak_stack_size << std::endl;
+        out << "output bytes:      " << output_bytes << std::endl;
+    }
+
+    void report_json(std::ostream& out) const {
+        out << "{\"phases\": [";
+        for (size_t i = 0; i < m_phases.size(); i++) {
+            const PhaseStats& phase = m_phases[i];
+            out << (i > 0 ? ", " : "") << "{\"name\": \"" << phase.name << "\", \"ms\": " << std::fixed
+                << std::setprecision(3) << phase.ms << ", \"allocs\": " << phase.allocs
+                << ", \"alloc_bytes\": " << phase.alloc_bytes << "}";
+        }
+        out << "], \"source_bytes\": " << source_bytes
+            << ", \"tokens\": " << tokens
+            << ", \"token_bytes_used\": " << tokens * sizeof(Token)
+            << ", \"token_bytes_reserved\": " << token_bytes_reserved
+            << ", \"ast_nodes\": " << ast_nodes
+            << ", \"ast_bytes_used\": " << ast_bytes_used
+            << ", \"ast_bytes_reserved\": " << ast_bytes_reserved
+            << ", \"vars\": " << vars
+            << ", \"peak_stack_slots\": " << peak_stack_size
+            << ", \"output_bytes\": " << output_bytes << "}" << std::endl;
+    }
+
+private:
+    std::vector<PhaseStats> m_phases;
+};
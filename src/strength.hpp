@@ -0,0 +1,106 @@
+// Contains the arithmetic behind strength reducing multiplications and divisions by constants
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+// how to multiply by a constant with at most two cheap instructions (lea, shl, add, sub, neg) instead of imul
+// the lea forms compute x + x * scale, which covers 3, 5 and 9
+struct MulPlan {
+    enum class Kind : uint8_t {
+        none, // no cheap sequence, use imul
+        zero, // the product is 0
+        copy, // x, negated below for -1
+        shift, // x << shift
+        lea, // (x + x * scale1) << shift
+        lea_lea, // (x + x * scale1) * (1 + scale2)
+        shift_add, // (x << shift) + x
+        shift_sub, // (x << shift) - x
+    };
+
+    Kind kind = Kind::none;
+    uint8_t scale1 = 0;
+    uint8_t scale2 = 0;
+    uint8_t shift = 0;
+    bool negate = false; // the product of the sequence is negated at the end
+};
+
+// 2, 4 or 8 if `factor` is 3, 5 or 9, otherwise 0
+[[nodiscard]] inline constexpr uint8_t lea_scale(uint64_t factor) {
+    return factor == 3 || factor == 5 || factor == 9 ? static_cast<uint8_t>(factor - 1) : 0;
+}
+
+[[nodiscard]] inline constexpr MulPlan plan_mul(int64_t c) {
+    if (c == 0) {
+        return {.kind = MulPlan::Kind::zero};
+    }
+    if (c == 1 || c == -1) {
+        return {.kind = MulPlan::Kind::copy, .negate = c < 0};
+    }
+    // multiplication wraps, so x * -c is -(x * c) even for the smallest integer
+    const uint64_t magnitude = c < 0 ? 0 - static_cast<uint64_t>(c) : static_cast<uint64_t>(c);
+    const auto shift = static_cast<uint8_t>(std::countr_zero(magnitude));
+    const uint64_t odd = magnitude >> shift;
+    if (odd == 1) {
+        return {.kind = MulPlan::Kind::shift, .shift = shift, .negate = c < 0};
+    }
+    if (const uint8_t scale = lea_scale(odd); scale != 0 && (shift == 0 || c > 0)) {
+        return {.kind = MulPlan::Kind::lea, .scale1 = scale, .shift = shift, .negate = c < 0};
+    }
+    if (shift != 0 || c < 0) {
+        return {};
+    }
+    for (uint64_t first = 3; first <= 9; first += first - 1) { // 3, 5, 9
+        if (odd % first == 0 && lea_scale(odd / first) != 0) {
+            return {.kind = MulPlan::Kind::lea_lea, .scale1 = lea_scale(first), .scale2 = lea_scale(odd / first)};
+        }
+    }
+    if (std::has_single_bit(odd - 1)) {
+        return {.kind = MulPlan::Kind::shift_add, .shift = static_cast<uint8_t>(std::countr_zero(odd - 1))};
+    }
+    if (std::has_single_bit(odd + 1)) {
+        return {.kind = MulPlan::Kind::shift_sub, .shift = static_cast<uint8_t>(std::countr_zero(odd + 1))};
+    }
+    return {};
+}
+
+// the multiplier and shift that turn a signed division by `d` into a multiplication by its scaled reciprocal
+// for |d| >= 2 and not a power of two: q = (high 64 bits of multiplier * n, +n if d > 0 and the multiplier is
+// negative, -n if d < 0 and it is positive) >> shift, then +1 if that is negative so the quotient truncates
+// Hacker's Delight 10-1 (Granlund & Montgomery), carried out for 64 bits
+struct DivMagic {
+    int64_t multiplier;
+    int shift;
+};
+
+[[nodiscard]] inline constexpr DivMagic div_magic(int64_t d) {
+    constexpr uint64_t two63 = 1ull << 63;
+    const uint64_t ad = d < 0 ? 0 - static_cast<uint64_t>(d) : static_cast<uint64_t>(d);
+    const uint64_t t = two63 + (static_cast<uint64_t>(d) >> 63);
+    const uint64_t anc = t - 1 - t % ad; // |nc|, the largest dividend whose remainder is d - 1
+    int p = 63;
+    uint64_t q1 = two63 / anc; // 2^p / |nc|
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad; // 2^p / |d|
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta = 0;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    const auto multiplier = static_cast<int64_t>(q2 + 1);
+    return {.multiplier = d < 0 ? static_cast<int64_t>(0 - static_cast<uint64_t>(multiplier)) : multiplier, .shift = p - 64};
+}
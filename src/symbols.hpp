@@ -0,0 +1,101 @@
+// Contains the symbol table that interns identifiers into dense 32 bit ids
+#pragma once
+
+#include <vector>
+#include <string_view>
+#include <cstdint>
+
+// maps every distinct identifier to an id, handed out in order of first appearance starting at 0
+// open addressing with linear probing over a power of two table. each slot holds the hash and the name's view
+// next to the id, so a lookup touches the slot and the name's bytes and nothing else. on big programs the table
+// does not fit in cache and every extra dependent load is a miss. growing never rehashes a string
+class SymbolTable {
+public:
+    inline SymbolTable() {
+        m_slots.resize(initial_capacity);
+    }
+
+    // the id of `name`, a new one if it has not been seen before
+    uint32_t intern(std::string_view name) {
+        const uint64_t h = hash(name);
+        size_t index = h & (m_slots.size() - 1);
+        while (!m_slots[index].empty()) {
+            const Slot& slot = m_slots[index];
+            if (slot.hash == h && slot.name() == name) {
+                return slot.id;
+            }
+            index = (index + 1) & (m_slots.size() - 1);
+        }
+
+        const auto id = static_cast<uint32_t>(m_names.size());
+        m_names.push_back(name);
+        m_slots[index] = {.hash = h, .data = name.data(), .size = static_cast<uint32_t>(name.size()), .id = id};
+        // keep the load factor at or below 1/2
+        if (m_names.size() * 2 > m_slots.size()) {
+            grow();
+        }
+        return id;
+    }
+
+    [[nodiscard]] inline size_t size() const {
+        return m_names.size();
+    }
+
+    [[nodiscard]] inline std::string_view name(uint32_t id) const {
+        return m_names[id];
+    }
+
+    // the names indexed by id, the table is empty afterwards
+    [[nodiscard]] inline std::vector<std::string_view> take_names() {
+        std::vector<std::string_view> names = std::move(m_names);
+        m_names.clear();
+        m_slots.assign(initial_capacity, Slot {});
+        return names;
+    }
+
+private:
+    static constexpr size_t initial_capacity = 256;
+
+    // identifiers are never empty, so a zero size marks a free slot
+    struct Slot {
+        uint64_t hash = 0;
+        const char* data = nullptr;
+        uint32_t size = 0;
+        uint32_t id = 0;
+
+        [[nodiscard]] inline bool empty() const {
+            return size == 0;
+        }
+        [[nodiscard]] inline std::string_view name() const {
+            return {data, size};
+        }
+    };
+
+    // FNV-1a over the bytes followed by a final mix, identifiers are short so this beats anything block based
+    [[nodiscard]] static inline uint64_t hash(std::string_view name) {
+        uint64_t h = 0xCBF29CE484222325ull;
+        for (char c : name) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+        }
+        return h ^ (h >> 32);
+    }
+
+    void grow() {
+        std::vector<Slot> old(m_slots.size() * 2);
+        old.swap(m_slots);
+        for (const Slot& slot : old) {
+            if (slot.empty()) {
+                continue;
+            }
+            size_t index = slot.hash & (m_slots.size() - 1);
+            while (!m_slots[index].empty()) {
+                index = (index + 1) & (m_slots.size() - 1);
+            }
+            m_slots[index] = slot;
+        }
+    }
+
+    // member vars
+    std::vector<Slot> m_slots;
+    std::vector<std::string_view> m_names; // id -> name, views into the source
+};
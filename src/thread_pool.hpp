@@ -0,0 +1,116 @@
+// Contains the fixed size thread pool used to run parts of the compiler in parallel
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+// a set of worker threads that run parallel_for jobs, the calling thread always works on the job as well
+class ThreadPool {
+public:
+    // `threads` counts the calling thread, so threads - 1 workers are started
+    inline explicit ThreadPool(size_t threads) {
+        for (size_t i = 1; i < threads; i++) {
+            m_workers.emplace_back([this] { work(); });
+        }
+    }
+
+    // number of threads (workers + caller) that run a job
+    [[nodiscard]] inline size_t thread_count() const {
+        return m_workers.size() + 1;
+    }
+
+    // calls fn(0) .. fn(count - 1) spread over the threads and returns once all of them are done
+    // indices are handed out one at a time, so uneven pieces of work balance out
+    template <typename Fn>
+    void parallel_for(size_t count, Fn&& fn) {
+        if (count == 0) {
+            return;
+        }
+        auto job = std::make_shared<Job>();
+        job->fn = std::forward<Fn>(fn);
+        job->count = count;
+        {
+            std::lock_guard lock(m_mutex);
+            m_job = job;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        run(*job);
+        std::unique_lock lock(m_mutex);
+        m_finished.wait(lock, [&] { return job->done == job->count; });
+        m_job.reset();
+    }
+
+    inline ThreadPool(const ThreadPool& other) = delete;
+
+    inline ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    inline ~ThreadPool() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+private:
+    // workers keep their own reference, so one that wakes up late only finds an exhausted job
+    struct Job {
+        std::function<void(size_t)> fn;
+        size_t count = 0;
+        std::atomic<size_t> next {0};
+        std::atomic<size_t> done {0};
+    };
+
+    void work() {
+        uint64_t seen = 0;
+        while (true) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop) {
+                    return;
+                }
+                seen = m_generation;
+                job = m_job;
+            }
+            if (job != nullptr) {
+                run(*job);
+            }
+        }
+    }
+
+    void run(Job& job) {
+        while (true) {
+            const size_t index = job.next.fetch_add(1, std::memory_order_relaxed);
+            if (index >= job.count) {
+                return;
+            }
+            job.fn(index);
+            if (job.done.fetch_add(1, std::memory_order_acq_rel) + 1 == job.count) {
+                std::lock_guard lock(m_mutex);
+                m_finished.notify_all();
+            }
+        }
+    }
+
+    // member vars
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake; // a new job was posted or the pool is stopping
+    std::condition_variable m_finished; // the last index of the current job is done
+    std::shared_ptr<Job> m_job;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
@@ -3,11 +3,19 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <array>
 #include <optional>
+#include <span>
+
+#include "char_scan.hpp"
+#include "diagnostics.hpp"
+#include "symbols.hpp"
 
 // enum class is some C++ wizardry that allows for comparison of integers using string 'identifiers'
-enum class TokenType {
+enum class TokenType : uint8_t {
     exit,
     int_lit,
     semi,
@@ -17,137 +25,167 @@ enum class TokenType {
     let,
     eq,
     plus,
-    multi
+    multi,
+    minus,
+    div
 };
 
 // Actual token class to be referenced throughout the parser
-// Contains both the type of token and optionally an associated literal value
+// Contains both the type of token and a view of its text in the source (empty for symbols and keywords)
+// identifiers also carry their interned symbol id (see symbols.hpp), which fits in the padding after the type
+// tokens never own memory, so the source buffer has to outlive them
 struct Token {
     TokenType type;
-    std::optional<std::string> value;
+    uint32_t symbol = 0;
+    std::string_view value;
+};
+
+// keywords, looked up with a perfect hash on length and first char instead of comparing against each of them
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+inline constexpr Keyword keywords[] = {
+    {"exit", TokenType::exit},
+    {"let", TokenType::let},
 };
 
+[[nodiscard]] inline constexpr size_t keyword_hash(std::string_view word) {
+    return (word.size() ^ static_cast<unsigned char>(word[0])) & 3;
+}
+
+// slot -> index into keywords + 1, 0 for empty slots
+inline constexpr std::array<uint8_t, 4> keyword_table = [] {
+    std::array<uint8_t, 4> table {};
+    for (size_t i = 0; i < std::size(keywords); i++) {
+        table[keyword_hash(keywords[i].text)] = static_cast<uint8_t>(i + 1);
+    }
+    return table;
+}();
+
+static_assert([] {
+    for (size_t i = 0; i < std::size(keywords); i++) {
+        if (keyword_table[keyword_hash(keywords[i].text)] != i + 1) {
+            return false;
+        }
+    }
+    return true;
+}(), "keyword_hash has collisions, pick another hash");
+
+// the keyword `word` spells, nothing for identifiers
+[[nodiscard]] inline constexpr std::optional<TokenType> keyword(std::string_view word) {
+    const uint8_t slot = keyword_table[keyword_hash(word)];
+    if (slot != 0 && keywords[slot - 1].text == word) {
+        return keywords[slot - 1].type;
+    }
+    return {};
+}
+
+// token type of every single char symbol
+inline constexpr std::array<TokenType, 256> symbol_tokens = [] {
+    std::array<TokenType, 256> table {};
+    table['('] = TokenType::open_paren;
+    table[')'] = TokenType::close_paren;
+    table[';'] = TokenType::semi;
+    table['='] = TokenType::eq;
+    table['+'] = TokenType::plus;
+    table['*'] = TokenType::multi;
+    table['-'] = TokenType::minus;
+    table['/'] = TokenType::div;
+    return table;
+}();
+
 class Tokenizer {
 public:
-    inline explicit Tokenizer(std::string src)
-        : m_src(std::move(src))
+    inline explicit Tokenizer(std::string_view src)
+        : m_src(src)
     {
     }
 
     // function to tokenize entire content string
-    // returns a vector of tokens, containing every token in the program    
+    // returns a vector of tokens, containing every token in the program
+    // every byte is dispatched on a constexpr class table, runs of whitespace, identifier chars and digits are
+    // skipped 16 / 32 bytes at a time (see char_scan.hpp)
     inline std::vector<Token> tokenize() {
         std::vector<Token> tokens;
-        std::string buf; // buffer for containing a sequence of chars to be analyzed and used for tokenization at a later time
-        
-        // read through the src code char by char until peek no longer returns a value
-        while (peek().has_value()) {
-            // if we encounter an alphabetic char, it must be either a keyword or identifier
-            if (std::isalpha(peek().value())) {
-                buf.push_back(consume()); // consume initial alpha char
-
-                // identifiers or keywords may continue with alpha or num chars
-                while(peek().has_value() && std::isalnum(peek().value())) {
-                    buf.push_back(consume()); // continue consuming
-                }
+        // sizing the buffer up front saves regrowing (copying and faulting in) a buffer many times the source size,
+        // the vectorized count costs a small fraction of that
+        tokens.reserve(estimate_token_count(m_src) + 1);
 
-                // now, we have the word and need to check if it's a keyword. otherwise, it must be an identifier
-                // std::cout << buf << std::endl;
-
-                // keyword checks
-                if (buf == "exit") {
-                    tokens.push_back({.type = TokenType::exit});
-                    buf.clear();
-                    continue;
-                } else if (buf == "let") {
-                    tokens.push_back({.type = TokenType::let});
-                    buf.clear();
-                    continue;
-                }
-                
-                // buffer is an identifier
-                else {
-                    tokens.push_back({.type = TokenType::ident, .value = buf});
-                    buf.clear();
-                    continue;
-                }
-            } 
-
-            // if we encounter a digit, we must be reading an integer literal
-            else if (std::isdigit(peek().value())) {
-                buf.push_back(consume()); // consume the initial int
-
-                // integers may continue as digits
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume()); // continue reading into the buffer
-                }
-
-                tokens.push_back({.type = TokenType::int_lit, .value = buf});
-                buf.clear();
-                continue;
-            } 
-            // misc symbols / chars checking
-            else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({.type = TokenType::open_paren});
-                continue;
-            }
-            else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({.type = TokenType::close_paren});
-                continue;
-            }
-            else if (peek().value() == ';') {
-                tokens.push_back({.type = TokenType::semi});
-                consume();
-                continue;
-            } 
-            else if (peek().value() == '=') {
-                tokens.push_back({.type = TokenType::eq});
-                consume();
-                continue;
-            }
-            else if (peek().value() == '+') {
-                tokens.push_back({.type = TokenType::plus});
-                consume();
-                continue;
-            }
-            else if (peek().value() == '*') {
-                tokens.push_back({.type = TokenType::multi});
-                consume();
-                continue;
-            }
-            else if (std::isspace(peek().value())) {
-                consume();
-                continue;
-            } 
-            
-            // unidentified char
-            else {
-                std::cerr << "Illegal character: " << peek().value() << std::endl;
-                exit(EXIT_FAILURE);
-            }
+        const char* const end = m_src.data() + m_src.size();
+        const char* p = m_src.data();
+        while (p < end) {
+            p = lex(p, end, [&](const Token& token) { tokens.push_back(token); });
         }
 
-        m_index = 0;
         return tokens;
     }
-private:
-    // peek looks ahead in the src code, usually to the next char, but optionally more
-    [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
-        if (m_index + offset >= m_src.length()) {
-            return {};
+
+    // lexes tokens into `out` until it is full or the source ends, carrying on where the last call stopped
+    // returns the number of tokens written, 0 once the whole source has been lexed. the streaming parser pulls its
+    // tokens through this, so they never all exist at once
+    inline size_t fill(std::span<Token> out) {
+        const char* const end = m_src.data() + m_src.size();
+        const char* p = m_src.data() + m_offset;
+        size_t count = 0;
+        while (p < end && count < out.size()) {
+            p = lex(p, end, [&](const Token& token) { out[count++] = token; });
         }
+        m_offset = static_cast<size_t>(p - m_src.data());
+        return count;
+    }
+
+    // the identifiers seen so far, ids are handed out as they are lexed
+    [[nodiscard]] inline const SymbolTable& symbols() const {
+        return m_symbols;
+    }
 
-        return m_src.at(m_index + offset);
+    // names of the identifiers seen by tokenize(), indexed by symbol id
+    [[nodiscard]] inline std::vector<std::string_view> take_symbols() {
+        return m_symbols.take_names();
     }
 
-    // actually advances to the next char in the src
-    inline char consume() {
-        return m_src.at(m_index++);
+private:
+    // lexes what starts at `p`, a token or a run of whitespace, and hands the token to `emit`
+    // returns where the next one starts
+    template <typename Emit>
+    inline const char* lex(const char* p, const char* end, Emit&& emit) {
+        switch (char_class(*p)) {
+            case CharClass::space:
+                return scan_run(CharRun::space, p + 1, end);
+            // an alphabetic char starts either a keyword or an identifier, both continue with alpha or num chars
+            case CharClass::alpha: {
+                const char* start = p;
+                p = scan_run(CharRun::alnum, p + 1, end);
+                const std::string_view word(start, static_cast<size_t>(p - start));
+                if (auto type = keyword(word)) {
+                    emit({.type = type.value(), .symbol = 0, .value = {}});
+                } else {
+                    emit({.type = TokenType::ident, .symbol = m_symbols.intern(word), .value = word});
+                }
+                return p;
+            }
+            // a digit starts an integer literal
+            case CharClass::digit: {
+                const char* start = p;
+                p = scan_run(CharRun::digit, p + 1, end);
+                const std::string_view digits(start, static_cast<size_t>(p - start));
+                emit({.type = TokenType::int_lit, .symbol = 0, .value = digits});
+                return p;
+            }
+            case CharClass::symbol:
+                emit({.type = symbol_tokens[static_cast<unsigned char>(*p)], .symbol = 0, .value = {}});
+                return p + 1;
+            // unidentified char
+            case CharClass::illegal:
+                break;
+        }
+        front_end_error("Illegal character: ", *p);
     }
 
     // member vars
-    const std::string m_src; // entire src code
-    size_t m_index = 0; // position pointer
-};
\ No newline at end of file
+    const std::string_view m_src; // entire src code, owned by the caller
+    size_t m_offset = 0; // where fill carries on
+    SymbolTable m_symbols; // identifiers are interned as they are lexed
+};
@@ -0,0 +1,126 @@
+// Contains the description of the x86-64 target shared by the register allocator and the code generators
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// general purpose registers, numbered by their hardware encoding
+enum class Reg : uint8_t {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+inline constexpr int reg_count = 16;
+
+// 64 bit register names as nasm expects them
+[[nodiscard]] inline constexpr std::string_view reg_name(Reg reg) {
+    constexpr std::string_view names[reg_count] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[static_cast<int>(reg)];
+}
+
+// callee-saved registers under the System V ABI, they must be preserved when the code is called as a function
+[[nodiscard]] inline constexpr bool is_callee_saved(Reg reg) {
+    switch (reg) {
+        case Reg::rbx:
+        case Reg::rsp:
+        case Reg::rbp:
+        case Reg::r12:
+        case Reg::r13:
+        case Reg::r14:
+        case Reg::r15:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// mnemonics the code generators emit
+enum class Op : uint8_t {
+    mov,
+    lea, // dst (a register) = the address src (a memory operand) names, nothing is loaded
+    push,
+    pop,
+    add,
+    sub,
+    imul, // two operand form: dst (a register) *= src
+    imul_wide, // one operand form: rdx:rax = rax * dst, signed
+    neg,
+    shl, // dst shifted by the immediate src
+    shr,
+    sar,
+    cqo, // sign extends rax into rdx:rax
+    idiv, // signed divide of rdx:rax by dst, quotient in rax, remainder in rdx
+    syscall,
+    ret,
+};
+
+inline constexpr int op_count = static_cast<int>(Op::ret) + 1;
+
+[[nodiscard]] inline constexpr std::string_view op_name(Op op) {
+    constexpr std::string_view names[op_count] = {
+        "mov", "lea", "push", "pop", "add", "sub", "imul", "imul", "neg", "shl", "shr", "sar", "cqo", "idiv",
+        "syscall", "ret"
+    };
+    return names[static_cast<int>(op)];
+}
+
+// a register, immediate or QWORD [base + index * scale + disp] memory operand, scale 0 means there is no index
+struct Operand {
+    enum class Kind : uint8_t {
+        none,
+        reg,
+        imm,
+        mem,
+    };
+
+    Kind kind = Kind::none;
+    Reg reg = Reg::rax; // the register, or the base register of a memory operand
+    Reg index = Reg::rax;
+    uint8_t scale = 0; // 0, or 1, 2, 4 or 8
+    int32_t disp = 0;
+    int64_t imm = 0;
+
+    static constexpr Operand r(Reg reg) {
+        return {.kind = Kind::reg, .reg = reg};
+    }
+    static constexpr Operand i(int64_t imm) {
+        return {.kind = Kind::imm, .imm = imm};
+    }
+    static constexpr Operand m(Reg base, int32_t disp) {
+        return {.kind = Kind::mem, .reg = base, .disp = disp};
+    }
+    // the index can be any register but rsp
+    static constexpr Operand m(Reg base, Reg index, uint8_t scale, int32_t disp) {
+        return {.kind = Kind::mem, .reg = base, .index = index, .scale = scale, .disp = disp};
+    }
+
+    [[nodiscard]] constexpr bool is_reg() const {
+        return kind == Kind::reg;
+    }
+    [[nodiscard]] constexpr bool is_imm() const {
+        return kind == Kind::imm;
+    }
+    [[nodiscard]] constexpr bool is_mem() const {
+        return kind == Kind::mem;
+    }
+    [[nodiscard]] constexpr bool has_index() const {
+        return kind == Kind::mem && scale != 0;
+    }
+
+    constexpr bool operator==(const Operand& other) const = default;
+};
+
+// one machine instruction, `dst` and `src` are unused (Kind::none) for instructions with fewer operands
+struct Instr {
+    Op op;
+    Operand dst {};
+    Operand src {};
+};
+
+// true if `value` survives being encoded as a sign extended 32 bit immediate
+[[nodiscard]] inline constexpr bool fits_imm32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
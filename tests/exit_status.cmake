@@ -0,0 +1,10 @@
+# runs PROGRAM with --interp and with --run at every optimization level and fails unless all of them end the same
+# way, the interpreter is the reference for what the program does (division traps included)
+# usage: cmake -DCLEAR=<clear> -DPROGRAM=<file.clr> -P exit_status.cmake
+execute_process(COMMAND ${CLEAR} --interp ${PROGRAM} RESULT_VARIABLE expected OUTPUT_QUIET ERROR_QUIET)
+foreach(level -O0 -O1 -O2)
+    execute_process(COMMAND ${CLEAR} ${level} --run ${PROGRAM} RESULT_VARIABLE status OUTPUT_QUIET ERROR_QUIET)
+    if(NOT "${status}" STREQUAL "${expected}")
+        message(FATAL_ERROR "${PROGRAM}: ${level} ended with '${status}', --interp with '${expected}'")
+    endif()
+endforeach()